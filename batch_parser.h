@@ -0,0 +1,236 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+#include "homework.h"
+
+
+struct ParseError {
+    uint64_t line_number;
+    const char* reason;
+};
+
+// Parses the OrderCommandParser text format straight out of a large buffer
+// (typically a MappedFile) into caller-provided OrderRecord batches. New
+// orders may also end with a ",@<participant>" field. Lines are split with
+// memchr, which glibc vectorizes, and fields are converted in place without
+// building strings. Malformed lines are skipped and reported through errors()
+// instead of aborting.
+class BatchOrderParser {
+public:
+    explicit BatchOrderParser(std::string_view buffer) : cursor_(buffer.data()), end_(buffer.data() + buffer.size()) {
+    }
+
+    // Writes up to batch.size() records and returns how many were written;
+    // zero means the input is exhausted.
+    size_t Next(std::span<OrderRecord> batch) {
+        size_t count = 0;
+        while (count < batch.size() && cursor_ != end_) {
+            const char* line_end = static_cast<const char*>(std::memchr(cursor_, '\n', end_ - cursor_));
+            if (!line_end) {
+                line_end = end_;
+            }
+            ++line_number_;
+            const char* reason = nullptr;
+            switch (ParseLine(cursor_, line_end, batch[count], &reason)) {
+                case LineResult::kRecord:
+                    ++count;
+                    break;
+                case LineResult::kSkipped:
+                    break;
+                case LineResult::kError:
+                    errors_.push_back({.line_number = line_number_, .reason = reason});
+                    break;
+            }
+            cursor_ = line_end == end_ ? end_ : line_end + 1;
+        }
+        return count;
+    }
+
+    bool done() const {
+        return cursor_ == end_;
+    }
+
+    uint64_t line_number() const {
+        return line_number_;
+    }
+
+    const std::vector<ParseError>& errors() const {
+        return errors_;
+    }
+
+private:
+    enum class LineResult {
+        kRecord,
+        kSkipped,
+        kError,
+    };
+
+    static bool IsBlank(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    static void SkipBlanks(const char*& p, const char* end) {
+        while (p != end && IsBlank(*p)) {
+            ++p;
+        }
+    }
+
+    // Consumes optional blanks, the digits of a uint32_t and optional blanks.
+    static bool ParseNumber(const char*& p, const char* end, uint32_t& value) {
+        SkipBlanks(p, end);
+        const char* digits_begin = p;
+        uint64_t result = 0;
+        while (p != end && static_cast<unsigned char>(*p - '0') < 10) {
+            result = result * 10 + (*p - '0');
+            if (result > std::numeric_limits<uint32_t>::max()) {
+                return false;
+            }
+            ++p;
+        }
+        if (p == digits_begin) {
+            return false;
+        }
+        SkipBlanks(p, end);
+        value = static_cast<uint32_t>(result);
+        return true;
+    }
+
+    // Consumes a field separator if there is one.
+    static bool NextField(const char*& p, const char* end) {
+        if (p != end && *p == ',') {
+            ++p;
+            return true;
+        }
+        return false;
+    }
+
+    static LineResult ParseLine(const char* p, const char* end, OrderRecord& record, const char** reason) {
+        SkipBlanks(p, end);
+        if (p == end || *p == '#') {
+            return LineResult::kSkipped;
+        }
+        record = OrderRecord{};
+        if (static_cast<unsigned char>(*p - '0') < 10) {
+            if (!ParseNumber(p, end, record.symbol) || !NextField(p, end)) {
+                *reason = "invalid symbol";
+                return LineResult::kError;
+            }
+            SkipBlanks(p, end);
+            if (p == end) {
+                *reason = "wrong number of fields";
+                return LineResult::kError;
+            }
+        }
+        char tag = *p++;
+        switch (tag) {
+            case 'B':
+                record.side = BUY_OS;
+                break;
+            case 'S':
+                record.side = SELL_OS;
+                break;
+            case 'C':
+                record.action = OrderAction::kCancel;
+                break;
+            case 'M':
+                record.action = OrderAction::kModify;
+                break;
+            default:
+                *reason = "unknown side";
+                return LineResult::kError;
+        }
+        if (!NextField(p, end)) {
+            *reason = "wrong number of fields";
+            return LineResult::kError;
+        }
+        if (!ParseNumber(p, end, record.id)) {
+            *reason = "invalid id";
+            return LineResult::kError;
+        }
+        if (record.action == OrderAction::kCancel) {
+            if (p != end) {
+                *reason = "wrong number of fields";
+                return LineResult::kError;
+            }
+            return LineResult::kRecord;
+        }
+
+        uint32_t price;
+        if (!NextField(p, end)) {
+            *reason = "wrong number of fields";
+            return LineResult::kError;
+        }
+        if (!ParseNumber(p, end, price)) {
+            *reason = "invalid price";
+            return LineResult::kError;
+        }
+        if (price >= std::numeric_limits<uint16_t>::max()) {
+            *reason = "price is too large";
+            return LineResult::kError;
+        }
+        record.price = static_cast<uint16_t>(price);
+        if (!NextField(p, end)) {
+            *reason = "wrong number of fields";
+            return LineResult::kError;
+        }
+        if (!ParseNumber(p, end, record.quantity)) {
+            *reason = "invalid quantity";
+            return LineResult::kError;
+        }
+        if (record.action == OrderAction::kAdd && NextField(p, end)) {
+            SkipBlanks(p, end);
+            bool participant_field = p != end && *p == '@';
+            if (!participant_field) {
+                if (p != end && static_cast<unsigned char>(*p - '0') >= 10) {
+                    const char* name_begin = p;
+                    while (p != end && *p != ',' && !IsBlank(*p)) {
+                        ++p;
+                    }
+                    std::optional<OrderType> type = ParseImmediateOrderType(std::string_view(name_begin, p - name_begin));
+                    if (!type) {
+                        *reason = "unknown order type";
+                        return LineResult::kError;
+                    }
+                    record.type = *type;
+                    SkipBlanks(p, end);
+                } else {
+                    record.type = ICEBERG_ORDER;
+                    if (!ParseNumber(p, end, record.peak_size)) {
+                        *reason = "invalid peak size";
+                        return LineResult::kError;
+                    }
+                }
+                if (NextField(p, end)) {
+                    SkipBlanks(p, end);
+                    participant_field = p != end && *p == '@';
+                    if (!participant_field) {
+                        *reason = "wrong number of fields";
+                        return LineResult::kError;
+                    }
+                }
+            }
+            if (participant_field) {
+                ++p;
+                if (!ParseNumber(p, end, record.participant)) {
+                    *reason = "invalid participant";
+                    return LineResult::kError;
+                }
+            }
+        }
+        if (p != end) {
+            *reason = "wrong number of fields";
+            return LineResult::kError;
+        }
+        return LineResult::kRecord;
+    }
+
+    const char* cursor_;
+    const char* end_;
+    uint64_t line_number_ = 0;
+    std::vector<ParseError> errors_;
+};
@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+#include "batch_parser.h"
+#include "mapped_file.h"
+#include <cstdio>
+#include <fstream>
+
+TEST(BatchOrderParserTest, ParsesAllLineKinds) {
+    std::string input =
+        "# header\n"
+        "B,100322,5103,7500\n"
+        "  S, 100345 ,5103,100000,10000\r\n"
+        "\n"
+        "C,100322\n"
+        "M,100345,5104,500";
+    BatchOrderParser parser(input);
+    std::vector<OrderRecord> batch(8);
+    ASSERT_EQ(parser.Next(batch), 4);
+    EXPECT_TRUE(parser.done());
+    EXPECT_TRUE(parser.errors().empty());
+
+    EXPECT_EQ(batch[0].action, OrderAction::kAdd);
+    EXPECT_EQ(batch[0].type, LIMIT_ORDER);
+    EXPECT_EQ(batch[0].side, BUY_OS);
+    EXPECT_EQ(batch[0].id, 100322);
+    EXPECT_EQ(batch[0].price, 5103);
+    EXPECT_EQ(batch[0].quantity, 7500);
+
+    EXPECT_EQ(batch[1].type, ICEBERG_ORDER);
+    EXPECT_EQ(batch[1].side, SELL_OS);
+    EXPECT_EQ(batch[1].id, 100345);
+    EXPECT_EQ(batch[1].quantity, 100000);
+    EXPECT_EQ(batch[1].peak_size, 10000);
+
+    EXPECT_EQ(batch[2].action, OrderAction::kCancel);
+    EXPECT_EQ(batch[2].id, 100322);
+
+    EXPECT_EQ(batch[3].action, OrderAction::kModify);
+    EXPECT_EQ(batch[3].id, 100345);
+    EXPECT_EQ(batch[3].price, 5104);
+    EXPECT_EQ(batch[3].quantity, 500);
+
+    EXPECT_EQ(parser.Next(batch), 0);
+}
+
+TEST(BatchOrderParserTest, ParsesSymbolField) {
+    std::string input =
+        "42,B,100322,5103,7500\n"
+        " 7 ,C,100322\n"
+        "B,1,2,3\n"
+        "1x,B,1,2,3\n"
+        "9,\n";
+    BatchOrderParser parser(input);
+    std::vector<OrderRecord> batch(8);
+    ASSERT_EQ(parser.Next(batch), 3);
+    EXPECT_EQ(batch[0].symbol, 42);
+    EXPECT_EQ(batch[0].id, 100322);
+    EXPECT_EQ(batch[1].symbol, 7);
+    EXPECT_EQ(batch[1].action, OrderAction::kCancel);
+    EXPECT_EQ(batch[2].symbol, 0);
+    ASSERT_EQ(parser.errors().size(), 2);
+    EXPECT_STREQ(parser.errors()[0].reason, "invalid symbol");
+    EXPECT_STREQ(parser.errors()[1].reason, "wrong number of fields");
+}
+
+TEST(BatchOrderParserTest, ParsesImmediateOrderTypes) {
+    std::string input =
+        "B,1,100,10,IOC\n"
+        "S,2,0,10, MARKET \n"
+        "3,B,3,100,10,FOK\n"
+        "B,4,100,10,GTC\n"
+        "B,5,100,10,IOC,1\n";
+    BatchOrderParser parser(input);
+    std::vector<OrderRecord> batch(8);
+    ASSERT_EQ(parser.Next(batch), 3);
+    EXPECT_EQ(batch[0].type, IOC_ORDER);
+    EXPECT_EQ(batch[0].quantity, 10);
+    EXPECT_EQ(batch[1].type, MARKET_ORDER);
+    EXPECT_EQ(batch[1].side, SELL_OS);
+    EXPECT_EQ(batch[2].type, FOK_ORDER);
+    EXPECT_EQ(batch[2].symbol, 3);
+    ASSERT_EQ(parser.errors().size(), 2);
+    EXPECT_STREQ(parser.errors()[0].reason, "unknown order type");
+    EXPECT_STREQ(parser.errors()[1].reason, "wrong number of fields");
+}
+
+TEST(BatchOrderParserTest, ParsesParticipantField) {
+    std::string input =
+        "B,1,100,10,@42\n"
+        "S,2,100,50,5, @7 \n"
+        "B,3,100,10,IOC,@9\n"
+        "B,4,100,10\n"
+        "B,5,100,10,@\n"
+        "B,6,100,10,IOC,\n"
+        "M,7,100,10,@3\n";
+    BatchOrderParser parser(input);
+    std::vector<OrderRecord> batch(8);
+    ASSERT_EQ(parser.Next(batch), 4);
+    EXPECT_EQ(batch[0].participant, 42);
+    EXPECT_EQ(batch[0].type, LIMIT_ORDER);
+    EXPECT_EQ(batch[1].participant, 7);
+    EXPECT_EQ(batch[1].peak_size, 5);
+    EXPECT_EQ(batch[2].participant, 9);
+    EXPECT_EQ(batch[2].type, IOC_ORDER);
+    EXPECT_EQ(batch[3].participant, 0);
+    ASSERT_EQ(parser.errors().size(), 3);
+    EXPECT_STREQ(parser.errors()[0].reason, "invalid participant");
+    EXPECT_STREQ(parser.errors()[1].reason, "wrong number of fields");
+    EXPECT_STREQ(parser.errors()[2].reason, "wrong number of fields");
+}
+
+TEST(BatchOrderParserTest, ReportsErrorsAndContinues) {
+    std::string input =
+        "X,1,2,3\n"
+        "B,1,65535,3\n"
+        "B,1,2\n"
+        "B,1,2,3,4,5\n"
+        "S,4294967296,2,3\n"
+        "C,1,2\n"
+        "B,a,2,3\n"
+        "S,7,8,9\n";
+    BatchOrderParser parser(input);
+    std::vector<OrderRecord> batch(1);
+    ASSERT_EQ(parser.Next(batch), 1);
+    EXPECT_EQ(batch[0].id, 7);
+    EXPECT_EQ(parser.line_number(), 8);
+
+    std::vector<std::string> reasons;
+    for (const ParseError& error : parser.errors()) {
+        reasons.push_back(absl::StrFormat("%u:%s", error.line_number, error.reason));
+    }
+    EXPECT_EQ(reasons, std::vector<std::string>({
+        "1:unknown side",
+        "2:price is too large",
+        "3:wrong number of fields",
+        "4:wrong number of fields",
+        "5:invalid id",
+        "6:wrong number of fields",
+        "7:invalid id",
+    }));
+}
+
+TEST(BatchOrderParserTest, SmallBatchesOverMappedFile) {
+    std::string path = ::testing::TempDir() + "/batch_parser_test.csv";
+    {
+        std::ofstream out(path);
+        for (int id = 0; id < 1000; ++id) {
+            out << (id % 2 ? "B," : "S,") << id << ',' << 100 + id % 10 << ",10\n";
+        }
+    }
+    std::string error;
+    std::optional<MappedFile> file = MappedFile::Open(path, &error);
+    ASSERT_TRUE(file) << error;
+
+    BatchOrderParser parser(file->data());
+    std::vector<OrderRecord> batch(7);
+    uint32_t expected_id = 0;
+    while (size_t count = parser.Next(batch)) {
+        for (size_t i = 0; i < count; ++i) {
+            EXPECT_EQ(batch[i].id, expected_id++);
+        }
+    }
+    EXPECT_EQ(expected_id, 1000);
+    std::remove(path.c_str());
+
+    EXPECT_FALSE(MappedFile::Open(path, &error));
+    EXPECT_FALSE(error.empty());
+}
+
+TEST(BatchOrderParserTest, AppliesToMatchingSystem) {
+    std::string input = "S,1,100,10\nB,2,100,4\nM,1,100,3\nC,2\n";
+    BatchOrderParser parser(input);
+    std::vector<OrderRecord> batch(4);
+    ASSERT_EQ(parser.Next(batch), 4);
+
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    EXPECT_TRUE(system.Apply(batch[0]));
+    EXPECT_TRUE(system.Apply(batch[1]));
+    EXPECT_TRUE(system.Apply(batch[2]));
+    EXPECT_FALSE(system.Apply(batch[3]));
+    system.Flush();
+    EXPECT_EQ(out.str(), "2,1,100,4\n");
+    EXPECT_EQ(system.order_book().Find(1)->quantity(), 3);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    ::testing::GTEST_FLAG(output) = "stdout";
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "integer_format.h"
+
+
+// Copy of the best levels of an OrderBook, taken on the matching thread with
+// OrderBook::CaptureSnapshot and rendered anywhere else. It holds plain arrays
+// only, so rendering never touches the book and a snapshot can be refilled
+// without allocating once its vectors have grown.
+struct BookSnapshot {
+    struct Level {
+        uint16_t price = 0;
+        uint32_t order_count = 0;
+        uint64_t volume = 0;        // Visible quantity of the resting orders.
+        uint64_t total_volume = 0;  // Including the hidden volume of icebergs.
+        uint32_t first_order = 0;   // Index of the level's first order in Side::orders.
+    };
+
+    struct Order {
+        uint32_t id = 0;
+        uint32_t quantity = 0;  // Visible quantity.
+        uint16_t price = 0;
+    };
+
+    struct Side {
+        std::vector<Level> levels;  // Best first.
+        // Level by level, each in time priority; empty unless orders were captured.
+        std::vector<Order> orders;
+
+        void Clear() {
+            levels.clear();
+            orders.clear();
+        }
+    };
+
+    uint64_t sequence = 0;  // Set by whoever takes the snapshot, e.g. the events applied so far.
+    Side buys;
+    Side sells;
+};
+
+enum class SnapshotFormat : uint8_t {
+    kTable,      // The ASCII order table of OrderBook::ToString.
+    kDepthJson,  // One JSON object of levels per snapshot.
+    kDepthCsv,   // One line per level.
+};
+
+
+// Appends the table OrderBook::ToString prints: the captured orders of both
+// sides next to each other, best first.
+inline void RenderTable(const BookSnapshot& snapshot, std::string& out) {
+    constexpr std::string_view kRule = "+-----------------------------------------------------------------+\n";
+    out.append(kRule);
+    out.append("| BUY                            | SELL                           |\n");
+    out.append("| Id       | Volume      | Price | Price | Volume      | Id       |\n");
+    out.append("+----------+-------------+-------+-------+-------------+----------+\n");
+
+    const std::vector<BookSnapshot::Order>& buys = snapshot.buys.orders;
+    const std::vector<BookSnapshot::Order>& sells = snapshot.sells.orders;
+    for (size_t row = 0; row < buys.size() || row < sells.size(); ++row) {
+        out.push_back('|');
+        if (row < buys.size()) {
+            AppendUnsigned(out, buys[row].id, 10);
+            out.push_back('|');
+            AppendGrouped(out, buys[row].quantity, 13);
+            out.push_back('|');
+            AppendGrouped(out, buys[row].price, 7);
+        } else {
+            out.append("          |             |       ");
+        }
+        out.push_back('|');
+        if (row < sells.size()) {
+            AppendGrouped(out, sells[row].price, 7);
+            out.push_back('|');
+            AppendGrouped(out, sells[row].quantity, 13);
+            out.push_back('|');
+            AppendUnsigned(out, sells[row].id, 10);
+        } else {
+            out.append("       |             |          ");
+        }
+        out.append("|\n");
+    }
+    out.append(kRule);
+}
+
+// Appends one line:
+//   {"sequence":7,"bids":[{"price":99,"volume":10,"total_volume":10,"orders":1}],"asks":[]}
+inline void RenderDepthJson(const BookSnapshot& snapshot, std::string& out) {
+    auto render_levels = [&out](const BookSnapshot::Side& side) {
+        out.push_back('[');
+        for (const BookSnapshot::Level& level : side.levels) {
+            if (&level != side.levels.data()) {
+                out.push_back(',');
+            }
+            out.append("{\"price\":");
+            AppendUnsigned(out, level.price);
+            out.append(",\"volume\":");
+            AppendUnsigned(out, level.volume);
+            out.append(",\"total_volume\":");
+            AppendUnsigned(out, level.total_volume);
+            out.append(",\"orders\":");
+            AppendUnsigned(out, level.order_count);
+            out.push_back('}');
+        }
+        out.push_back(']');
+    };
+    out.append("{\"sequence\":");
+    AppendUnsigned(out, snapshot.sequence);
+    out.append(",\"bids\":");
+    render_levels(snapshot.buys);
+    out.append(",\"asks\":");
+    render_levels(snapshot.sells);
+    out.append("}\n");
+}
+
+// Appends a line per level, bids then asks, each best first:
+//   sequence,side,level,price,volume,total_volume,orders
+// where side is B or S and level counts from 0 at the best price.
+inline void RenderDepthCsv(const BookSnapshot& snapshot, std::string& out) {
+    auto render_levels = [&](const BookSnapshot::Side& side, char side_name) {
+        for (size_t i = 0; i < side.levels.size(); ++i) {
+            const BookSnapshot::Level& level = side.levels[i];
+            AppendUnsigned(out, snapshot.sequence);
+            out.push_back(',');
+            out.push_back(side_name);
+            out.push_back(',');
+            AppendUnsigned(out, i);
+            out.push_back(',');
+            AppendUnsigned(out, level.price);
+            out.push_back(',');
+            AppendUnsigned(out, level.volume);
+            out.push_back(',');
+            AppendUnsigned(out, level.total_volume);
+            out.push_back(',');
+            AppendUnsigned(out, level.order_count);
+            out.push_back('\n');
+        }
+    };
+    render_levels(snapshot.buys, 'B');
+    render_levels(snapshot.sells, 'S');
+}
+
+inline void RenderSnapshot(const BookSnapshot& snapshot, SnapshotFormat format, std::string& out) {
+    switch (format) {
+        case SnapshotFormat::kTable:
+            RenderTable(snapshot, out);
+            break;
+        case SnapshotFormat::kDepthJson:
+            RenderDepthJson(snapshot, out);
+            break;
+        case SnapshotFormat::kDepthCsv:
+            RenderDepthCsv(snapshot, out);
+            break;
+    }
+}
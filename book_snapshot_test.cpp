@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include "book_snapshot.h"
+#include "homework.h"
+#include "snapshot_renderer.h"
+
+std::string Grouped(uint64_t value) {
+    std::string text;
+    AppendGrouped(text, value);
+    return text;
+}
+
+TEST(IntegerFormatTest, GroupsThousands) {
+    EXPECT_EQ(Grouped(0), "0");
+    EXPECT_EQ(Grouped(999), "999");
+    EXPECT_EQ(Grouped(1000), "1,000");
+    EXPECT_EQ(Grouped(65535), "65,535");
+    EXPECT_EQ(Grouped(1234567), "1,234,567");
+    EXPECT_EQ(Grouped(std::numeric_limits<uint64_t>::max()), "18,446,744,073,709,551,615");
+
+    std::string padded;
+    AppendUnsigned(padded, 42, 5);
+    AppendGrouped(padded, 12345, 3);
+    EXPECT_EQ(padded, "   4212,345");
+}
+
+TEST(BookSnapshotTest, CapturesLevelsAndRenders) {
+    std::ostringstream trades;
+    MatchingSystem system(OutputPolicy::TradesOnly(trades));
+    system.AddOrder(LimitOrder(BUY_OS, 1, 99, 1000));
+    system.AddOrder(IcebergOrder(BUY_OS, 2, 99, 5000, 500));
+    system.AddOrder(LimitOrder(BUY_OS, 3, 98, 20));
+    system.AddOrder(LimitOrder(SELL_OS, 4, 101, 1234567));
+
+    BookSnapshot snapshot;
+    system.order_book().CaptureSnapshot(snapshot, 1);
+    snapshot.sequence = 4;
+    ASSERT_EQ(snapshot.buys.levels.size(), 1);
+    EXPECT_EQ(snapshot.buys.levels[0].price, 99);
+    EXPECT_EQ(snapshot.buys.levels[0].order_count, 2);
+    EXPECT_EQ(snapshot.buys.levels[0].volume, 1500);
+    EXPECT_EQ(snapshot.buys.levels[0].total_volume, 6000);
+    ASSERT_EQ(snapshot.buys.orders.size(), 2);
+    EXPECT_EQ(snapshot.buys.orders[1].id, 2);
+    EXPECT_EQ(snapshot.buys.orders[1].quantity, 500);
+    ASSERT_EQ(snapshot.sells.levels.size(), 1);
+
+    std::string table;
+    RenderTable(snapshot, table);
+    EXPECT_EQ(table, system.order_book().ToString(1));
+    EXPECT_EQ(table,
+              "+-----------------------------------------------------------------+\n"
+              "| BUY                            | SELL                           |\n"
+              "| Id       | Volume      | Price | Price | Volume      | Id       |\n"
+              "+----------+-------------+-------+-------+-------------+----------+\n"
+              "|         1|        1,000|     99|    101|    1,234,567|         4|\n"
+              "|         2|          500|     99|       |             |          |\n"
+              "+-----------------------------------------------------------------+\n");
+
+    // Depth formats need the levels only.
+    system.order_book().CaptureSnapshot(snapshot, 2, false);
+    snapshot.sequence = 4;
+    EXPECT_TRUE(snapshot.buys.orders.empty());
+    std::string json;
+    RenderDepthJson(snapshot, json);
+    EXPECT_EQ(json,
+              "{\"sequence\":4,\"bids\":[{\"price\":99,\"volume\":1500,\"total_volume\":6000,\"orders\":2},"
+              "{\"price\":98,\"volume\":20,\"total_volume\":20,\"orders\":1}],"
+              "\"asks\":[{\"price\":101,\"volume\":1234567,\"total_volume\":1234567,\"orders\":1}]}\n");
+    std::string csv;
+    RenderDepthCsv(snapshot, csv);
+    EXPECT_EQ(csv,
+              "4,B,0,99,1500,6000,2\n"
+              "4,B,1,98,20,20,1\n"
+              "4,S,0,101,1234567,1234567,1\n");
+}
+
+TEST(SnapshotRendererTest, RendersTheLatestView) {
+    std::ostringstream trades;
+    MatchingSystem system(OutputPolicy::TradesOnly(trades));
+    std::ostringstream views;
+    uint64_t published = 0;
+    uint64_t dropped = 0;
+    {
+        SnapshotRenderer renderer(views, SnapshotFormat::kDepthCsv, 1);
+        for (uint32_t id = 0; id < 1000; ++id) {
+            system.AddOrder(LimitOrder(BUY_OS, id, static_cast<uint16_t>(100 + id), 1));
+            renderer.Publish(system.order_book(), id + 1);
+        }
+        published = renderer.published();
+        dropped = renderer.dropped();
+    }
+    EXPECT_EQ(published, 1000);
+    std::string text = views.str();
+    EXPECT_EQ(static_cast<uint64_t>(std::count(text.begin(), text.end(), '\n')), published - dropped);
+    EXPECT_TRUE(text.ends_with("1000,B,0,1099,1,1,1\n"));
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    ::testing::GTEST_FLAG(output) = "stdout";
+
+    return RUN_ALL_TESTS();
+}
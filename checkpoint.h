@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/str_format.h"
+#include "homework.h"
+#include "mapped_file.h"
+
+
+// Binary checkpoint of a book's resting orders: a CheckpointHeader followed by
+// fixed-width little-endian CheckpointRecords in OrderBook::ForEachOrder()
+// sequence, which keeps the time priority within each level.
+static_assert(std::endian::native == std::endian::little, "Checkpoint records are stored in host byte order");
+
+struct CheckpointHeader {
+    static constexpr char kMagic[8] = {'O', 'B', 'C', 'K', 'P', 'T', '\0', '\0'};
+    static constexpr uint32_t kVersion = 2;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t sequence;  // Input events applied to the book when it was captured.
+    uint64_t order_count;
+};
+
+struct CheckpointRecord {
+    uint32_t symbol;
+    uint32_t id;
+    uint32_t quantity;  // Visible volume.
+    uint32_t hidden_full_volume;
+    uint32_t peak_size;
+    uint16_t price;
+    uint8_t type;
+    uint8_t side;
+    uint32_t participant;
+
+    static CheckpointRecord FromOrder(const LimitOrder& order, uint32_t participant) {
+        return CheckpointRecord{
+            .symbol = order.symbol(),
+            .id = order.id(),
+            .quantity = order.quantity(),
+            .hidden_full_volume = order.hidden_full_volume(),
+            .peak_size = order.peak_size(),
+            .price = order.price(),
+            .type = static_cast<uint8_t>(order.type()),
+            .side = static_cast<uint8_t>(order.side()),
+            .participant = participant,
+        };
+    }
+
+    // Why OrderBook::Add would not take the record as a resting order, or
+    // nullptr if it would.
+    const char* Problem() const {
+        if (side != BUY_OS && side != SELL_OS) {
+            return "unknown side";
+        }
+        if (type != LIMIT_ORDER && type != ICEBERG_ORDER) {
+            return "not a resting order type";
+        }
+        if (price >= std::numeric_limits<uint16_t>::max()) {
+            return "price out of range";
+        }
+        if (quantity == 0) {
+            return "no visible volume";
+        }
+        if (type == ICEBERG_ORDER && (quantity > peak_size || quantity > hidden_full_volume)) {
+            return "visible volume above the peak or the full volume";
+        }
+        if (participant > MatchingSystem::kMaxParticipant) {
+            return "participant out of range";
+        }
+        return nullptr;
+    }
+
+    // Only valid for a record without a Problem().
+    LimitOrder ToOrder() const {
+        OrderSide order_side = static_cast<OrderSide>(side);
+        if (type == ICEBERG_ORDER) {
+            LimitOrder order = IcebergOrder(order_side, id, price, hidden_full_volume, peak_size, symbol);
+            order.mutable_quantity() = quantity;
+            return order;
+        }
+        return LimitOrder(order_side, id, price, quantity, symbol);
+    }
+};
+
+static_assert(sizeof(CheckpointHeader) == 32 && std::is_trivially_copyable_v<CheckpointHeader>);
+static_assert(sizeof(CheckpointRecord) == 28 && std::is_trivially_copyable_v<CheckpointRecord>);
+
+
+// In-memory copy of a book. Capture() only copies the resting orders, so the
+// engine is paused for one pass over the book; encoding and writing the file
+// can then happen on another thread. ParticipantStats are not part of it: a
+// restored engine counts trades from the restore on.
+class Checkpoint {
+public:
+    static Checkpoint Capture(const OrderBook& order_book, uint64_t sequence) {
+        Checkpoint checkpoint;
+        checkpoint.sequence_ = sequence;
+        checkpoint.orders_.reserve(order_book.size());
+        checkpoint.participants_.reserve(order_book.size());
+        order_book.ForEachOrder([&checkpoint](const LimitOrder& order, uint32_t participant) {
+            checkpoint.orders_.push_back(order);
+            checkpoint.participants_.push_back(participant);
+        });
+        return checkpoint;
+    }
+
+    static std::optional<Checkpoint> Read(const std::string& path, std::string* error) {
+        std::optional<MappedFile> file = MappedFile::Open(path, error);
+        if (!file) {
+            return std::nullopt;
+        }
+        std::string_view data = file->data();
+        CheckpointHeader header;
+        if (data.size() < sizeof(header) || std::memcmp(data.data(), CheckpointHeader::kMagic, sizeof(CheckpointHeader::kMagic)) != 0) {
+            *error = absl::StrFormat("%s is not a checkpoint", path);
+            return std::nullopt;
+        }
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (header.version != CheckpointHeader::kVersion || header.record_size != sizeof(CheckpointRecord)) {
+            *error = absl::StrFormat("%s has unsupported checkpoint version %u with %u-byte records", path, header.version, header.record_size);
+            return std::nullopt;
+        }
+        // Divides first, so a damaged count cannot overflow the size it implies.
+        size_t record_bytes = data.size() - sizeof(header);
+        if (header.order_count > record_bytes / sizeof(CheckpointRecord) || record_bytes != header.order_count * sizeof(CheckpointRecord)) {
+            *error = absl::StrFormat("%s should hold %u orders but has %u bytes of them", path, header.order_count, data.size() - sizeof(header));
+            return std::nullopt;
+        }
+        Checkpoint checkpoint;
+        checkpoint.sequence_ = header.sequence;
+        checkpoint.orders_.reserve(header.order_count);
+        checkpoint.participants_.reserve(header.order_count);
+        absl::flat_hash_set<uint32_t> ids;
+        ids.reserve(header.order_count);
+        int32_t best_buy = -1;
+        int32_t best_sell = PriceLevelBitmap::kLevels;
+        const char* records = data.data() + sizeof(header);
+        for (uint64_t i = 0; i < header.order_count; ++i) {
+            CheckpointRecord record;
+            std::memcpy(&record, records + i * sizeof(record), sizeof(record));
+            if (const char* problem = record.Problem()) {
+                *error = absl::StrFormat("%s record %u is invalid: %s", path, i, problem);
+                return std::nullopt;
+            }
+            if (!ids.insert(record.id).second) {
+                *error = absl::StrFormat("%s record %u repeats order id %u", path, i, record.id);
+                return std::nullopt;
+            }
+            if (record.side == BUY_OS) {
+                best_buy = std::max<int32_t>(best_buy, record.price);
+            } else {
+                best_sell = std::min<int32_t>(best_sell, record.price);
+            }
+            if (best_buy >= best_sell) {
+                *error = absl::StrFormat("%s record %u crosses the book at price %u", path, i, record.price);
+                return std::nullopt;
+            }
+            checkpoint.orders_.push_back(record.ToOrder());
+            checkpoint.participants_.push_back(record.participant);
+        }
+        return checkpoint;
+    }
+
+    // Returns false and sets `error` if the file could not be written.
+    bool Write(const std::string& path, std::string* error) const {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            *error = absl::StrFormat("Cannot create %s", path);
+            return false;
+        }
+        CheckpointHeader header{
+            .version = CheckpointHeader::kVersion,
+            .record_size = sizeof(CheckpointRecord),
+            .sequence = sequence_,
+            .order_count = orders_.size(),
+        };
+        std::memcpy(header.magic, CheckpointHeader::kMagic, sizeof(header.magic));
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::vector<CheckpointRecord> buffer;
+        buffer.reserve(std::min(orders_.size(), kBufferRecords));
+        for (size_t begin = 0; begin < orders_.size(); begin += kBufferRecords) {
+            buffer.clear();
+            for (size_t i = begin; i < std::min(orders_.size(), begin + kBufferRecords); ++i) {
+                buffer.push_back(CheckpointRecord::FromOrder(orders_[i], participants_[i]));
+            }
+            out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(CheckpointRecord));
+        }
+        out.flush();
+        if (!out) {
+            *error = absl::StrFormat("Cannot write %s", path);
+            return false;
+        }
+        return true;
+    }
+
+    // Writes on a separate thread; the future holds the error, empty on success.
+    static std::future<std::string> WriteInBackground(Checkpoint checkpoint, std::string path) {
+        return std::async(std::launch::async, [checkpoint = std::move(checkpoint), path = std::move(path)] {
+            std::string error;
+            checkpoint.Write(path, &error);
+            return error;
+        });
+    }
+
+    void RestoreInto(MatchingSystem& system) const {
+        system.RestoreOrders(orders_, participants_);
+    }
+
+    uint64_t sequence() const {
+        return sequence_;
+    }
+
+    const std::vector<LimitOrder>& orders() const {
+        return orders_;
+    }
+
+    // Parallel to orders().
+    const std::vector<uint32_t>& participants() const {
+        return participants_;
+    }
+
+private:
+    static constexpr size_t kBufferRecords = 64 * 1024;
+
+    Checkpoint() = default;
+
+    uint64_t sequence_ = 0;
+    std::vector<LimitOrder> orders_;
+    std::vector<uint32_t> participants_;
+};
@@ -0,0 +1,159 @@
+#include <gtest/gtest.h>
+#include "checkpoint.h"
+#include "order_flow_generator.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+std::string TempPath(const std::string& name) {
+    return ::testing::TempDir() + "/" + name;
+}
+
+}  // namespace
+
+TEST(CheckpointTest, RestoreAndReplayTail) {
+    std::string path = TempPath("checkpoint_test_restore.checkpoint");
+    OrderFlowConfig config;
+    config.iceberg_ratio = 0.3;
+    config.cancel_ratio = 0.1;
+    std::vector<OrderRecord> flow = OrderFlowGenerator(config).Generate(20000);
+    const size_t kCheckpointAt = 12000;
+    // Self-trade prevention makes the tail depend on the restored participants.
+    for (OrderRecord& record : flow) {
+        record.participant = record.id % 4;
+    }
+
+    std::ostringstream original_trades;
+    MatchingSystem original(OutputPolicy::TradesOnly(original_trades));
+    original.SetSelfTradePrevention(SelfTradePrevention::kCancelOldest);
+    for (size_t i = 0; i < kCheckpointAt; ++i) {
+        original.Apply(flow[i]);
+    }
+    std::future<std::string> written = Checkpoint::WriteInBackground(Checkpoint::Capture(original.order_book(), kCheckpointAt), path);
+    ASSERT_EQ(written.get(), "");
+    original.Flush();
+    original_trades.str("");
+
+    std::string error;
+    std::optional<Checkpoint> checkpoint = Checkpoint::Read(path, &error);
+    ASSERT_TRUE(checkpoint) << error;
+    EXPECT_EQ(checkpoint->sequence(), kCheckpointAt);
+    EXPECT_EQ(checkpoint->orders().size(), original.order_book().size());
+
+    std::ostringstream restored_trades;
+    MatchingSystem restored(OutputPolicy::TradesOnly(restored_trades));
+    restored.SetSelfTradePrevention(SelfTradePrevention::kCancelOldest);
+    checkpoint->RestoreInto(restored);
+    EXPECT_EQ(restored.order_book().ToString(), original.order_book().ToString());
+    for (size_t i = checkpoint->sequence(); i < flow.size(); ++i) {
+        original.Apply(flow[i]);
+        restored.Apply(flow[i]);
+    }
+    original.Flush();
+    restored.Flush();
+    EXPECT_FALSE(original_trades.str().empty());
+    EXPECT_EQ(restored_trades.str(), original_trades.str());
+    EXPECT_EQ(restored.order_book().ToString(), original.order_book().ToString());
+    std::remove(path.c_str());
+}
+
+TEST(CheckpointTest, ParticipantStatsRestartOnRestore) {
+    MatchingSystem original(OutputPolicy::TradesOnly());
+    original.TrackParticipants();
+    original.Apply({.id = 1, .quantity = 10, .side = SELL_OS, .price = 100, .participant = 1});
+    original.Apply({.id = 2, .quantity = 15, .side = SELL_OS, .price = 101, .participant = 1});
+    original.Apply({.id = 3, .quantity = 4, .side = BUY_OS, .price = 100, .participant = 2});
+    Checkpoint checkpoint = Checkpoint::Capture(original.order_book(), 3);
+
+    MatchingSystem restored(OutputPolicy::TradesOnly());
+    restored.TrackParticipants();
+    checkpoint.RestoreInto(restored);
+    EXPECT_EQ(restored.order_book().Participant(2), 1);
+    EXPECT_EQ(restored.participant_stats(1), ParticipantStats{});
+    EXPECT_EQ(restored.participant_stats(2), ParticipantStats{});
+
+    OrderRecord tail{.id = 4, .quantity = 6, .side = BUY_OS, .price = 100, .participant = 2};
+    original.Apply(tail);
+    restored.Apply(tail);
+    EXPECT_EQ(original.participant_stats(2).bought, 10);
+    EXPECT_EQ(restored.participant_stats(2), (ParticipantStats{.bought = 6, .bought_notional = 600}));
+    EXPECT_EQ(restored.participant_stats(1), (ParticipantStats{.sold = 6, .sold_notional = 600}));
+}
+
+TEST(CheckpointTest, RejectsDamagedFiles) {
+    std::string path = TempPath("checkpoint_test_damaged.checkpoint");
+    MatchingSystem system(OutputPolicy::TradesOnly());
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 1, 100, 10));
+    std::string error;
+    ASSERT_TRUE(Checkpoint::Capture(system.order_book(), 1).Write(path, &error)) << error;
+
+    std::ifstream in(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << contents.substr(0, contents.size() - 1);
+    EXPECT_FALSE(Checkpoint::Read(path, &error));
+    EXPECT_NE(error.find("should hold 1 orders"), std::string::npos) << error;
+
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "B,1,100,10\n";
+    EXPECT_FALSE(Checkpoint::Read(path, &error));
+    EXPECT_NE(error.find("is not a checkpoint"), std::string::npos) << error;
+
+    // A count whose size in bytes wraps around to the file's.
+    CheckpointHeader header;
+    std::memcpy(&header, contents.data(), sizeof(header));
+    header.order_count += uint64_t{1} << 62;
+    std::string huge = contents;
+    std::memcpy(huge.data(), &header, sizeof(header));
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << huge;
+    EXPECT_FALSE(Checkpoint::Read(path, &error));
+    EXPECT_NE(error.find("should hold"), std::string::npos) << error;
+    std::remove(path.c_str());
+}
+
+TEST(CheckpointTest, RejectsRecordsTheBookWouldNotTake) {
+    std::string path = TempPath("checkpoint_test_records.checkpoint");
+    MatchingSystem system(OutputPolicy::TradesOnly());
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 1, 99, 10));
+    system.AddOrder(IcebergOrder(OrderSide::SELL_OS, 2, 101, 100, 10));
+    std::string error;
+    // Sells come first: record 0 is the iceberg, record 1 the buy.
+    ASSERT_TRUE(Checkpoint::Capture(system.order_book(), 2).Write(path, &error)) << error;
+    std::ifstream in(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+
+    auto read_with = [&](size_t index, auto&& damage) {
+        std::string damaged = contents;
+        CheckpointRecord record;
+        char* at = damaged.data() + sizeof(CheckpointHeader) + index * sizeof(CheckpointRecord);
+        std::memcpy(&record, at, sizeof(record));
+        damage(record);
+        std::memcpy(at, &record, sizeof(record));
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << damaged;
+        error.clear();
+        return Checkpoint::Read(path, &error).has_value();
+    };
+    EXPECT_TRUE(read_with(0, [](CheckpointRecord&) {})) << error;
+    EXPECT_FALSE(read_with(1, [](CheckpointRecord& record) { record.side = 7; }));
+    EXPECT_NE(error.find("record 1 is invalid: unknown side"), std::string::npos) << error;
+    EXPECT_FALSE(read_with(0, [](CheckpointRecord& record) { record.type = MARKET_ORDER; }));
+    EXPECT_NE(error.find("not a resting order type"), std::string::npos) << error;
+    EXPECT_FALSE(read_with(0, [](CheckpointRecord& record) { record.price = std::numeric_limits<uint16_t>::max(); }));
+    EXPECT_NE(error.find("price out of range"), std::string::npos) << error;
+    EXPECT_FALSE(read_with(0, [](CheckpointRecord& record) { record.quantity = 50; }));
+    EXPECT_NE(error.find("above the peak"), std::string::npos) << error;
+    EXPECT_FALSE(read_with(1, [](CheckpointRecord& record) { record.id = 2; }));
+    EXPECT_NE(error.find("repeats order id 2"), std::string::npos) << error;
+    EXPECT_FALSE(read_with(1, [](CheckpointRecord& record) { record.price = 101; }));
+    EXPECT_NE(error.find("crosses the book at price 101"), std::string::npos) << error;
+    std::remove(path.c_str());
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    ::testing::GTEST_FLAG(output) = "stdout";
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+// Timestamp for latency measurements: the TSC where available, which costs a
+// few nanoseconds, and steady_clock nanoseconds elsewhere.
+inline uint64_t ReadCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// ReadCycleCounter() ticks per nanosecond, measured once per process.
+inline double CycleCounterTicksPerNanosecond() {
+    static const double ticks_per_nanosecond = [] {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t start_ticks = ReadCycleCounter();
+        while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(5)) {
+        }
+        uint64_t ticks = ReadCycleCounter() - start_ticks;
+        return ticks / static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }();
+    return ticks_per_nanosecond;
+}
+
+// Fixed-size log-linear histogram in the style of HdrHistogram: values below
+// 2^kSubBucketBits are counted exactly and every larger power of two is split
+// into 2^(kSubBucketBits - 1) buckets, so a recorded value is off by at most
+// about 3%. Recording is a bit scan and an increment.
+class Histogram {
+public:
+    static constexpr int kSubBucketBits = 6;
+    static constexpr size_t kBuckets = ((64 - kSubBucketBits) << (kSubBucketBits - 1)) + (size_t{1} << kSubBucketBits);
+
+    void Record(uint64_t value) {
+        ++buckets_[BucketOf(value)];
+        ++count_;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void Merge(const Histogram& other) {
+        for (size_t i = 0; i < kBuckets; ++i) {
+            buckets_[i] += other.buckets_[i];
+        }
+        count_ += other.count_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    void Reset() {
+        *this = Histogram();
+    }
+
+    uint64_t count() const {
+        return count_;
+    }
+
+    uint64_t min() const {
+        return count_ ? min_ : 0;
+    }
+
+    uint64_t max() const {
+        return max_;
+    }
+
+    // Smallest recorded value such that `percentile` percent of the values are
+    // not larger, up to the bucket resolution.
+    uint64_t ValueAtPercentile(double percentile) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(percentile / 100 * count_ + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += buckets_[i];
+            if (seen >= rank) {
+                return std::clamp(BucketUpperBound(i), min_, max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    static size_t BucketOf(uint64_t value) {
+        int shift = std::max(static_cast<int>(std::bit_width(value)) - kSubBucketBits, 0);
+        return (static_cast<size_t>(shift) << (kSubBucketBits - 1)) + (value >> shift);
+    }
+
+    static uint64_t BucketUpperBound(size_t bucket) {
+        if (bucket < (size_t{1} << kSubBucketBits)) {
+            return bucket;
+        }
+        int shift = static_cast<int>(bucket >> (kSubBucketBits - 1)) - 1;
+        uint64_t base = bucket - (static_cast<size_t>(shift) << (kSubBucketBits - 1));
+        return ((base + 1) << shift) - 1;
+    }
+
+    std::array<uint64_t, kBuckets> buckets_{};
+    uint64_t count_ = 0;
+    uint64_t min_ = std::numeric_limits<uint64_t>::max();
+    uint64_t max_ = 0;
+};
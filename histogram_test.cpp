@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include "histogram.h"
+
+TEST(HistogramTest, SmallValuesAreExact) {
+    Histogram histogram;
+    for (uint64_t value = 1; value <= 50; ++value) {
+        histogram.Record(value);
+    }
+    EXPECT_EQ(histogram.count(), 50);
+    EXPECT_EQ(histogram.min(), 1);
+    EXPECT_EQ(histogram.max(), 50);
+    EXPECT_EQ(histogram.ValueAtPercentile(50), 25);
+    EXPECT_EQ(histogram.ValueAtPercentile(100), 50);
+}
+
+TEST(HistogramTest, LargeValuesWithinResolution) {
+    Histogram histogram;
+    for (uint64_t value = 1000; value <= 1000000; value += 1000) {
+        histogram.Record(value);
+    }
+    histogram.Record(uint64_t{1} << 63);
+    uint64_t median = histogram.ValueAtPercentile(50);
+    EXPECT_GE(median, 500000);
+    EXPECT_LE(median, 500000 * 1.04);
+    EXPECT_EQ(histogram.ValueAtPercentile(100), uint64_t{1} << 63);
+
+    Histogram other;
+    other.Record(7);
+    histogram.Merge(other);
+    EXPECT_EQ(histogram.count(), 1002);
+    EXPECT_EQ(histogram.min(), 7);
+    histogram.Reset();
+    EXPECT_EQ(histogram.count(), 0);
+    EXPECT_EQ(histogram.ValueAtPercentile(99), 0);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    ::testing::GTEST_FLAG(output) = "stdout";
+
+    return RUN_ALL_TESTS();
+}
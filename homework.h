@@ -1,70 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstdint>
+#include <functional>
 #include <istream>
 #include <iterator>
 #include <limits>
+#include <type_traits>
+#include <utility>
 #include <ostream>
 #include <random>
+#include <span>
 #include <vector>
-#include <unordered_map>
-#include <unordered_set>
 #include <string>
-#include <list>
 #include <variant>
 #include <memory>
-#include <map>
+#include <new>
 #include <optional>
 #include <glog/logging.h>
 #include "enums.pb.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/ascii.h"
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/numbers.h"
+#include "book_snapshot.h"
+#include "histogram.h"
+#include "integer_format.h"
+#include "spsc_queue.h"
 
 
-namespace std {
-    template <>
-    struct hash<std::pair<uint32_t, uint32_t>> {
-        size_t operator()(const std::pair<uint32_t, uint32_t>& k) const {
-            return (static_cast<size_t>(k.first) << 31) ^ k.second;
-        }
-    };
-}
+using OrderHandle = uint32_t;
+constexpr OrderHandle kNullOrderHandle = std::numeric_limits<OrderHandle>::max();
 
+template <OrderSide kSide>
+class BookSide;
 
+
+// Plain value describing both order types; icebergs differ only in their
+// fields, so no code path needs virtual calls or a downcast. `quantity` is the
+// visible volume, `hidden_full_volume` the total volume still to be traded and
+// `peak_size` what is shown again once the visible part is filled. A limit
+// order shows everything: its peak size is unbounded and its total volume
+// equals its visible one.
 class LimitOrder { 
 protected:
-    OrderType type_;
-    OrderSide side_;
     uint32_t id_;
-    uint16_t price_;
     uint32_t quantity_;
+    uint32_t hidden_full_volume_;
+    uint32_t peak_size_;
+    uint32_t symbol_;
+private:
+    // Intrusive links into the FIFO of the price level the order rests on.
+    template <OrderSide kSide>
+    friend class BookSide;
+    OrderHandle prev_ = kNullOrderHandle;
+    OrderHandle next_ = kNullOrderHandle;
+protected:
+    uint16_t price_;
+    uint8_t type_;
+    uint8_t side_;
+
+    LimitOrder(OrderType type, OrderSide side, uint32_t id, uint16_t price, uint32_t quantity, uint32_t hidden_full_volume, uint32_t peak_size, uint32_t symbol)
+        : id_(id), quantity_(quantity), hidden_full_volume_(hidden_full_volume), peak_size_(peak_size), symbol_(symbol),
+          price_(price), type_(static_cast<uint8_t>(type)), side_(static_cast<uint8_t>(side)) {
+    }
 public:
-    LimitOrder (OrderSide side, uint32_t id, uint16_t price, uint32_t quantity)
-                : type_(LIMIT_ORDER), side_(side), id_(id), price_(price), quantity_(quantity) {
+    LimitOrder (OrderSide side, uint32_t id, uint16_t price, uint32_t quantity, uint32_t symbol = 0)
+                : LimitOrder(LIMIT_ORDER, side, id, price, quantity, quantity, std::numeric_limits<uint32_t>::max(), symbol) {
     }
 
-    static bool MatchesPrice(std::shared_ptr<LimitOrder> order, std::shared_ptr<LimitOrder> opposite_order) {
-        if (order->side() == BUY_OS) {
-            return order->price() >= opposite_order->price();
+    static bool MatchesPrice(const LimitOrder& order, const LimitOrder& opposite_order) {
+        if (order.side() == BUY_OS) {
+            return order.price() >= opposite_order.price();
         } else {
-            return order->price() <= opposite_order->price();
+            return order.price() <= opposite_order.price();
         }
     }
 
-    static uint32_t CalculatePrice(std::shared_ptr<LimitOrder> order, std::shared_ptr<LimitOrder> opposite_order) {
-        return opposite_order->price(); 
+    static uint32_t CalculatePrice(const LimitOrder& order, const LimitOrder& opposite_order) {
+        return opposite_order.price(); 
     }
 
-    virtual void Fill(uint32_t other_quantity) {
+    void Fill(uint32_t other_quantity) {
         if (quantity_ < other_quantity) {
             LOG(FATAL) << absl::StrFormat("Remaining quantity of order is less than filled quantity: %u vs %u", quantity_, other_quantity);
         }
         quantity_ -= other_quantity;
+        hidden_full_volume_ -= other_quantity;
+    }
+
+    // Drops what is left of the visible volume and shows the next peak; returns
+    // the new visible volume, which is zero when nothing is left to trade.
+    uint32_t Replenish() {
+        hidden_full_volume_ -= quantity_;
+        quantity_ = std::min(hidden_full_volume_, peak_size_);
+        return quantity_;
     }
 
     OrderType type() const {
-        return type_;
+        return static_cast<OrderType>(type_);
+    }
+
+    // Whether a remainder left after matching joins the book.
+    bool rests() const {
+        return type() == LIMIT_ORDER || type() == ICEBERG_ORDER;
     }
 
     uint16_t price() const {
@@ -72,7 +116,7 @@ public:
     }
 
     OrderSide side() const {
-        return side_;
+        return static_cast<OrderSide>(side_);
     }
 
     uint32_t& mutable_quantity() & {
@@ -86,18 +130,9 @@ public:
     uint32_t id() const {
         return id_;
     }
-    
-    virtual ~LimitOrder() = default;
-};
 
-class IcebergOrder : public LimitOrder {
-private:
-    uint32_t peak_size_;
-    uint32_t hidden_full_volume_;
-public:
-    IcebergOrder(OrderSide side, uint32_t id, uint16_t price, uint32_t hidden_full_volume, uint32_t peak_size) 
-                 : LimitOrder(side, id, price, 0), peak_size_(peak_size), hidden_full_volume_(hidden_full_volume) {
-        type_ = ICEBERG_ORDER;
+    uint32_t symbol() const {
+        return symbol_;
     }
 
     uint32_t peak_size() const {
@@ -108,18 +143,103 @@ public:
         return hidden_full_volume_;
     }
 
-    
-    void Fill(uint32_t other_quantity) override {
-        LimitOrder::Fill(other_quantity);
-        hidden_full_volume_ -= other_quantity;
+    uint32_t& mutable_hidden_full_volume() & {
+        return hidden_full_volume_;
+    }
+};
+
+// Builds the LimitOrder of an iceberg. It adds no state, so passing it by
+// value as a LimitOrder keeps everything.
+class IcebergOrder : public LimitOrder {
+public:
+    IcebergOrder(OrderSide side, uint32_t id, uint16_t price, uint32_t hidden_full_volume, uint32_t peak_size, uint32_t symbol = 0) 
+                 : LimitOrder(ICEBERG_ORDER, side, id, price, 0, hidden_full_volume, peak_size, symbol) {
     }
+};
+
+// Builds the LimitOrder of a MARKET_ORDER, IOC_ORDER or FOK_ORDER. Market
+// orders get the most aggressive price of their side, so the limit checks of
+// the book apply to all three alike.
+class ImmediateOrder : public LimitOrder {
+public:
+    ImmediateOrder(OrderType type, OrderSide side, uint32_t id, uint16_t price, uint32_t quantity, uint32_t symbol = 0)
+                   : LimitOrder(type, side, id, type == MARKET_ORDER ? MarketPrice(side) : price, quantity, quantity,
+                                std::numeric_limits<uint32_t>::max(), symbol) {
+        if (type != MARKET_ORDER && type != IOC_ORDER && type != FOK_ORDER) {
+            LOG(FATAL) << absl::StrFormat("Order type %s is not an immediate order type", OrderType_Name(type));
+        }
+    }
+
+    static uint16_t MarketPrice(OrderSide side) {
+        return side == BUY_OS ? std::numeric_limits<uint16_t>::max() : 0;
+    }
+};
 
-    ~IcebergOrder() override = default;
+static_assert(sizeof(IcebergOrder) == sizeof(LimitOrder) && std::is_trivially_copyable_v<LimitOrder>);
+static_assert(sizeof(ImmediateOrder) == sizeof(LimitOrder));
+static_assert(sizeof(LimitOrder) == 32, "Two orders per cache line");
+
+
+enum class OrderAction : uint8_t {
+    kAdd,
+    kCancel,
+    kModify,
+};
+
+// Flat description of one input event, as produced by the batch parsers.
+struct OrderRecord {
+    uint32_t symbol = 0;
+    uint32_t id = 0;
+    uint32_t quantity = 0;   // Total volume for icebergs, the new quantity for kModify.
+    uint32_t peak_size = 0;  // Only used by ICEBERG_ORDER.
+    OrderType type = LIMIT_ORDER;
+    OrderSide side = BUY_OS;
+    uint16_t price = 0;
+    OrderAction action = OrderAction::kAdd;
+    uint32_t participant = 0;  // Owning account of added orders; 0 is anonymous.
 };
 
 
+// Names of the immediate order types in the text formats.
+inline const char* ImmediateOrderTypeName(OrderType type) {
+    switch (type) {
+        case MARKET_ORDER:
+            return "MARKET";
+        case IOC_ORDER:
+            return "IOC";
+        case FOK_ORDER:
+            return "FOK";
+        default:
+            return nullptr;
+    }
+}
+
+inline std::optional<OrderType> ParseImmediateOrderType(std::string_view name) {
+    for (OrderType type : {MARKET_ORDER, IOC_ORDER, FOK_ORDER}) {
+        if (name == ImmediateOrderTypeName(type)) {
+            return type;
+        }
+    }
+    return std::nullopt;
+}
+
+// Lines are "[<symbol>,]B|S,<id>,<price>,<quantity>[,<peak_size>|,MARKET|,IOC|,FOK]";
+// the numeric instrument field is optional and defaults to 0. The price of
+// market orders is ignored.
 class OrderParser {
 public:
+    // Splits off the optional leading instrument field.
+    static std::string_view ConsumeSymbol(std::string_view line, uint32_t* symbol) {
+        *symbol = 0;
+        size_t comma = line.find(',');
+        if (comma != std::string_view::npos && comma != 0 && std::all_of(line.begin(), line.begin() + comma, absl::ascii_isdigit)) {
+            if (absl::SimpleAtoi(line.substr(0, comma), symbol)) {
+                return line.substr(comma + 1);
+            }
+        }
+        return line;
+    }
+
     static std::optional<std::unique_ptr<LimitOrder>> Parse(const std::string& line) {
         auto it = std::find_if(line.begin(), line.end(), [](char c) {
             return !std::isspace(c);
@@ -128,6 +248,8 @@ public:
         if (considering_line.size() == 0 || considering_line.starts_with("#")) {
             return std::nullopt;
         }
+        uint32_t symbol;
+        considering_line = ConsumeSymbol(considering_line, &symbol);
         std::vector<std::string> strings = absl::StrSplit(considering_line, ',');
         if (strings.size() != 4 && strings.size() != 5) {
            return std::nullopt; 
@@ -145,24 +267,86 @@ public:
         if (price >= std::numeric_limits<uint16_t>::max()) LOG(FATAL) << "Price is too large: " << line;
         if (!absl::SimpleAtoi(strings[3], &quantity)) LOG(FATAL) << "Unknown quantity during parse: " << line;
         if (strings.size() == 4) {  // limit order
-            return std::make_unique<LimitOrder>(side, id, price, quantity);
+            return std::make_unique<LimitOrder>(side, id, price, quantity, symbol);
+        } else if (std::optional<OrderType> type = ParseImmediateOrderType(strings[4])) {
+            return std::make_unique<LimitOrder>(ImmediateOrder(*type, side, id, price, quantity, symbol));
         } else if (strings.size() == 5) { // iceberg order
             uint32_t peak_size;
             if (!absl::SimpleAtoi(strings[4], &peak_size)) LOG(FATAL) << "Unknown peak_size during parse: " << line;
-            return std::make_unique<IcebergOrder>(side, id, price, quantity, peak_size);
+            return std::make_unique<LimitOrder>(IcebergOrder(side, id, price, quantity, peak_size, symbol));
         } else{
             LOG(FATAL) << "Unreachable condition reached";
         }
     }
 };
 
+struct CancelOrderRequest {
+    uint32_t symbol;
+    uint32_t id;
+};
+
+struct ModifyOrderRequest {
+    uint32_t symbol;
+    uint32_t id;
+    uint16_t price;
+    uint32_t quantity;
+};
+
+using OrderCommand = std::variant<std::unique_ptr<LimitOrder>, CancelOrderRequest, ModifyOrderRequest>;
+
+class OrderCommandParser {
+public:
+    // Accepts everything OrderParser does plus "[<symbol>,]C,<id>" cancels and
+    // "[<symbol>,]M,<id>,<price>,<quantity>" modifications.
+    static std::optional<OrderCommand> Parse(const std::string& line) {
+        auto it = std::find_if(line.begin(), line.end(), [](char c) {
+            return !std::isspace(c);
+        });
+        uint32_t symbol;
+        std::string_view considering_line = OrderParser::ConsumeSymbol(std::string_view(it, line.end()), &symbol);
+        if (considering_line.starts_with("C,")) {
+            std::vector<std::string> strings = absl::StrSplit(considering_line, ',');
+            CancelOrderRequest request{.symbol = symbol};
+            if (strings.size() != 2) {
+                return std::nullopt;
+            }
+            if (!absl::SimpleAtoi(strings[1], &request.id)) LOG(FATAL) << "Unknown id during parse: " << line;
+            return request;
+        }
+        if (considering_line.starts_with("M,")) {
+            std::vector<std::string> strings = absl::StrSplit(considering_line, ',');
+            ModifyOrderRequest request{.symbol = symbol};
+            uint32_t price;
+            if (strings.size() != 4) {
+                return std::nullopt;
+            }
+            if (!absl::SimpleAtoi(strings[1], &request.id)) LOG(FATAL) << "Unknown id during parse: " << line;
+            if (!absl::SimpleAtoi(strings[2], &price)) LOG(FATAL) << "Unknown price during parse: " << line;
+            if (price >= std::numeric_limits<uint16_t>::max()) LOG(FATAL) << "Price is too large: " << line;
+            if (!absl::SimpleAtoi(strings[3], &request.quantity)) LOG(FATAL) << "Unknown quantity during parse: " << line;
+            request.price = price;
+            return request;
+        }
+        auto order = OrderParser::Parse(line);
+        if (!order) {
+            return std::nullopt;
+        }
+        return std::move(order.value());
+    }
+};
+
 struct Trade {
+    uint32_t symbol = 0;
     uint32_t buy_id; 
     uint32_t sell_id;
     uint16_t price;
     uint32_t quantity;
 
+    // The instrument is only printed when it is not the default one.
     std::string ToString() const {
+        if (symbol) {
+            return absl::StrFormat("%u,%u,%u,%hu,%u", symbol, buy_id, sell_id, price, quantity);
+        }
         return absl::StrFormat("%u,%u,%hu,%u", buy_id, sell_id, price, quantity);
     }
 
@@ -172,241 +356,1970 @@ struct Trade {
     }
 };
 
-struct TradeManager {
-    using MapType = std::unordered_map<std::pair<uint32_t, uint32_t>, std::pair<uint16_t, uint32_t>>;
-    MapType trades_;
+// Receives execution reports. OnTrade is called on the matching thread, so
+// implementations should not block for long.
+class TradeSink {
+public:
+    virtual void OnTrade(const Trade& trade) = 0;
+    virtual void Flush() {}
+    virtual ~TradeSink() = default;
+};
+
+class CallbackTradeSink : public TradeSink {
+public:
+    explicit CallbackTradeSink(std::function<void(const Trade&)> callback) : callback_(std::move(callback)) {
+    }
+
+    void OnTrade(const Trade& trade) override {
+        callback_(trade);
+    }
+
+private:
+    std::function<void(const Trade&)> callback_;
+};
+
+// Hands trades to a consumer thread. Waits while the queue is full, so no
+// report is ever dropped.
+class QueueTradeSink : public TradeSink {
+public:
+    explicit QueueTradeSink(SpscQueue<Trade>& queue, WaitPolicy wait_policy = WaitPolicy::kBusySpin)
+        : queue_(queue), backoff_(wait_policy) {
+    }
+
+    void OnTrade(const Trade& trade) override {
+        while (!queue_.TryPush(trade)) {
+            ++full_queue_spins_;
+            backoff_.Wait();
+        }
+        backoff_.Reset();
+    }
+
+    uint64_t full_queue_spins() const {
+        return full_queue_spins_;
+    }
+
+private:
+    SpscQueue<Trade>& queue_;
+    Backoff backoff_;
+    uint64_t full_queue_spins_ = 0;
+};
+
+// Formats trades as Trade::ToString lines into a local buffer and writes it to
+// the stream when it fills up or on Flush.
+class CsvTradeWriter : public TradeSink {
+public:
+    explicit CsvTradeWriter(std::ostream& out, size_t buffer_size = 64 * 1024)
+        : out_(out), buffer_(std::max(buffer_size, kMaxLineSize)) {
+    }
+
+    ~CsvTradeWriter() override {
+        Flush();
+    }
+
+    void OnTrade(const Trade& trade) override {
+        if (buffer_.size() - used_ < kMaxLineSize) {
+            Flush();
+        }
+        char* out = buffer_.data() + used_;
+        if (trade.symbol) {
+            out = FormatUnsigned(trade.symbol, out);
+            *out++ = ',';
+        }
+        out = FormatUnsigned(trade.buy_id, out);
+        *out++ = ',';
+        out = FormatUnsigned(trade.sell_id, out);
+        *out++ = ',';
+        out = FormatUnsigned(trade.price, out);
+        *out++ = ',';
+        out = FormatUnsigned(trade.quantity, out);
+        *out++ = '\n';
+        used_ = out - buffer_.data();
+    }
+
+    void Flush() override {
+        out_.write(buffer_.data(), used_);
+        used_ = 0;
+    }
+
+private:
+    static constexpr size_t kMaxLineSize = 4 * 10 + 5 + 5;
+
+    std::ostream& out_;
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+};
+
+// Reports the fills of one aggressor order. With aggregation enabled, fills
+// against the same resting order are merged and held until NotifyAll, in the
+// order they first happened; otherwise every fill goes straight to the sink.
+// Only a replenished iceberg is filled twice by one aggressor, so instead of
+// looking trades up by id the caller keeps a slot per resting order that
+// remembers where its pending trade is.
+class TradeManager {
 public:
-    void Append(uint32_t order_id, uint32_t opposite_order_id, OrderSide side, uint16_t price, uint32_t quantity) {
+    TradeManager(TradeSink& sink, bool aggregate) : sink_(sink), aggregate_(aggregate) {
+    }
+
+    // `pending_slot` belongs to the resting order; it may hold anything from
+    // an earlier aggressor and is checked against the trade it points to.
+    void Append(uint32_t symbol, uint32_t order_id, uint32_t opposite_order_id, OrderSide side, uint16_t price, uint32_t quantity, uint32_t& pending_slot) {
         uint32_t buy_id = (side == BUY_OS ? order_id : opposite_order_id);
         uint32_t sell_id = (side == SELL_OS ? order_id : opposite_order_id);
-        MapType::iterator it;
-        if ((it = trades_.find(std::make_pair(buy_id, sell_id))) != trades_.end()) {
-            if (it->second.first != price) {
-                LOG(FATAL) << absl::StrFormat("Price mismatch during TradeManager::Append %hu vs %hu", it->second.first, price); 
+        Trade trade {.symbol = symbol, .buy_id = buy_id, .sell_id = sell_id,  .price = price, .quantity = quantity};
+        if (!aggregate_) {
+            sink_.OnTrade(trade);
+            return;
+        }
+        if (pending_slot < pending_trades_.size()) {
+            Trade& pending_trade = pending_trades_[pending_slot];
+            if (pending_trade.buy_id == buy_id && pending_trade.sell_id == sell_id) {
+                if (pending_trade.price != price) {
+                    LOG(FATAL) << absl::StrFormat("Price mismatch during TradeManager::Append %hu vs %hu", pending_trade.price, price); 
+                }
+                pending_trade.quantity += quantity;
+                return;
             }
-            it->second.second += quantity;
-        } else {
-            trades_[{buy_id, sell_id}] = {price, quantity};
         }
+        if (pending_trades_.size() == max_pending_trades_) {
+            NotifyAll();
+        }
+        pending_slot = static_cast<uint32_t>(pending_trades_.size());
+        pending_trades_.push_back(trade);
     }
 
     void NotifyAll() {
-        for (auto&& [ids, trade_stat] : trades_) {
-            auto [buy_id, sell_id] = ids;
-            auto [price, quantity] = trade_stat;
-            Trade trade {.buy_id = buy_id, .sell_id = sell_id,  .price = price, .quantity = quantity};
-            std::cout << trade << '\n';
+        for (const Trade& trade : pending_trades_) {
+            sink_.OnTrade(trade);
         }
-        trades_.clear();
+        pending_trades_.clear();
+    }
+
+    // Holds at most `max_pending_trades` trades without allocating; an
+    // aggressor with more counterparties has its trades reported in chunks
+    // of that size, each aggregated on its own.
+    void Reserve(size_t max_pending_trades) {
+        max_pending_trades_ = std::max<size_t>(max_pending_trades, 1);
+        pending_trades_.reserve(max_pending_trades_);
     }
+
+    size_t memory_bytes() const {
+        return pending_trades_.capacity() * sizeof(Trade);
+    }
+
+private:
+    TradeSink& sink_;
+    bool aggregate_;
+    size_t max_pending_trades_ = std::numeric_limits<size_t>::max();
+    std::vector<Trade> pending_trades_;
 };
 
 
-class OrderBook {
-    using ListType = std::list<std::shared_ptr<LimitOrder>>;
-    using OrderBookType = std::map<uint32_t, ListType>;
-    OrderBookType sells_book_;
-    OrderBookType buys_book_;
+// Slab storage for resting orders. Handles stay valid until Release, and slots are
+// recycled through a free list, so steady-state matching never touches the heap.
+// The participant of each order lives in a parallel slab: only self-trade
+// prevention and participant tracking read it, so it stays out of the cache
+// lines the match loop walks. A third slab keeps each order's pending-trade
+// slot for TradeManager.
+class OrderPool {
 public:
+    static constexpr uint32_t kSlabSize = 4096;
 
-    std::optional<std::shared_ptr<LimitOrder>> GetOpposite(const OrderSide& order_side) const {
-        if  (order_side == SELL_OS) {
-            if (buys_book_.empty()) {
-                return std::nullopt;
-            }
-            return buys_book_.rbegin()->second.front();
-        } else if (order_side == BUY_OS) {
-            if (sells_book_.empty()) {
-                return std::nullopt;
-            }
-            return sells_book_.begin()->second.front();
-        } else {
-            LOG(FATAL) << absl::StrFormat("OrderSide is not supported %s", OrderSide_Name(order_side));
-            return std::nullopt;
+    OrderPool() = default;
+    OrderPool(const OrderPool&) = delete;
+    OrderPool& operator=(const OrderPool&) = delete;
+
+    OrderHandle Emplace(const LimitOrder& order, uint32_t participant = 0) {
+        if (free_handles_.empty()) {
+            Grow();
+        }
+        OrderHandle handle = free_handles_.back();
+        free_handles_.pop_back();
+        new (slot(handle).storage) LimitOrder(order);
+        participant_slabs_[handle / kSlabSize][handle % kSlabSize] = participant;
+        ++size_;
+        return handle;
+    }
+
+    void Release(OrderHandle handle) {
+        (*this)[handle].~LimitOrder();
+        free_handles_.push_back(handle);
+        --size_;
+    }
+
+    LimitOrder& operator[](OrderHandle handle) {
+        return *std::launder(reinterpret_cast<LimitOrder*>(slot(handle).storage));
+    }
+
+    const LimitOrder& operator[](OrderHandle handle) const {
+        return *std::launder(reinterpret_cast<const LimitOrder*>(slot(handle).storage));
+    }
+
+    uint32_t participant(OrderHandle handle) const {
+        return participant_slabs_[handle / kSlabSize][handle % kSlabSize];
+    }
+
+    uint32_t& pending_trade(OrderHandle handle) {
+        return pending_trade_slabs_[handle / kSlabSize][handle % kSlabSize];
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    size_t capacity() const {
+        return slabs_.size() * kSlabSize;
+    }
+
+    size_t slab_count() const {
+        return slabs_.size();
+    }
+
+    size_t memory_bytes() const {
+        return slabs_.size() * kSlabSize * (sizeof(Slot) + 2 * sizeof(uint32_t)) + free_handles_.capacity() * sizeof(OrderHandle);
+    }
+
+    // Allocates up front so that `orders` orders fit without growing.
+    void Reserve(size_t orders) {
+        while (capacity() - size_ < orders) {
+            Grow();
+        }
+    }
+
+private:
+    struct Slot {
+        alignas(LimitOrder) std::byte storage[sizeof(LimitOrder)];
+    };
+
+    Slot& slot(OrderHandle handle) {
+        return slabs_[handle / kSlabSize][handle % kSlabSize];
+    }
+
+    const Slot& slot(OrderHandle handle) const {
+        return slabs_[handle / kSlabSize][handle % kSlabSize];
+    }
+
+    void Grow() {
+        OrderHandle first = static_cast<OrderHandle>(capacity());
+        slabs_.push_back(std::make_unique<Slot[]>(kSlabSize));
+        participant_slabs_.push_back(std::make_unique<uint32_t[]>(kSlabSize));
+        pending_trade_slabs_.push_back(std::make_unique<uint32_t[]>(kSlabSize));
+        free_handles_.reserve(capacity());
+        for (OrderHandle handle = first + kSlabSize; handle > first; --handle) {
+            free_handles_.push_back(handle - 1);
         }
     }
 
-    void Add(std::shared_ptr<LimitOrder> order) {
-        if (order->quantity() == 0) {
+    std::vector<std::unique_ptr<Slot[]>> slabs_;
+    std::vector<std::unique_ptr<uint32_t[]>> participant_slabs_;
+    std::vector<std::unique_ptr<uint32_t[]>> pending_trade_slabs_;
+    std::vector<OrderHandle> free_handles_;
+    size_t size_ = 0;
+};
+
+
+// Non-empty price levels, one bit each, with a summary bit per word. The
+// words come in chunks of 4096 levels, one per summary word, allocated when a
+// level in them is first set; a set summary bit implies its chunk exists.
+class PriceLevelBitmap {
+public:
+    static constexpr uint32_t kLevels = static_cast<uint32_t>(std::numeric_limits<uint16_t>::max()) + 1;
+
+    void Set(uint16_t price) {
+        Allocate(price);
+        (*chunks_[price >> 12])[(price >> 6) & 63] |= Bit(price);
+        summary_[price >> 12] |= Bit(price >> 6);
+    }
+
+    void Reset(uint16_t price) {
+        if (!chunks_[price >> 12]) {
             return;
         }
-        auto opposite_order = GetOpposite(order->side());
-        if (opposite_order && LimitOrder::MatchesPrice(order, opposite_order.value())) {
-            LOG(FATAL) << absl::StrFormat("Adding order with price %hu while exists opposite order with price: %hu", order->price(), opposite_order.value()->price());
+        uint64_t& word = (*chunks_[price >> 12])[(price >> 6) & 63];
+        word &= ~Bit(price);
+        if (word == 0) {
+            summary_[price >> 12] &= ~Bit(price >> 6);
         }
-        if (order->side() == SELL_OS) {
-            sells_book_[order->price()].push_back(order);
-        } else if (order->side() == BUY_OS) {
-            buys_book_[order->price()].push_back(order);  
+    }
+
+    bool Test(uint16_t price) const {
+        return Word(price >> 6) & Bit(price);
+    }
+
+    // Allocates the chunk holding `price` ahead of its first Set().
+    void Allocate(uint16_t price) {
+        if (!chunks_[price >> 12]) {
+            chunks_[price >> 12] = std::make_unique<Chunk>();
+            ++allocated_chunks_;
         }
     }
 
-    void PopOpposite(const OrderSide& order_side) {
-        auto deleted_order = GetOpposite(order_side).value();
-        
-        if  (order_side == SELL_OS) {
-            buys_book_.rbegin()->second.pop_front();
-            if (buys_book_.rbegin()->second.empty()) {
-                buys_book_.erase(buys_book_.rbegin()->first);
-            }
-        } else if (order_side == BUY_OS) {
-            sells_book_.begin()->second.pop_front();
-            if (sells_book_.begin()->second.empty()) {
-                sells_book_.erase(sells_book_.begin()->first);
+    size_t memory_bytes() const {
+        return sizeof(*this) + allocated_chunks_ * sizeof(Chunk);
+    }
+
+    // Lowest non-empty level strictly above `price`.
+    std::optional<uint16_t> NextAbove(uint32_t price) const {
+        uint32_t from = price + 1;
+        if (from >= kLevels) {
+            return std::nullopt;
+        }
+        uint64_t bits = Word(from >> 6) & (~uint64_t{0} << (from & 63));
+        if (bits) {
+            return static_cast<uint16_t>((from & ~63u) + std::countr_zero(bits));
+        }
+        for (uint32_t word = (from >> 6) + 1; word < kWords; ) {
+            uint64_t summary_bits = summary_[word >> 6] & (~uint64_t{0} << (word & 63));
+            if (summary_bits) {
+                uint32_t found_word = (word & ~63u) + std::countr_zero(summary_bits);
+                return static_cast<uint16_t>((found_word << 6) + std::countr_zero(Word(found_word)));
             }
+            word = (word & ~63u) + 64;
         }
+        return std::nullopt;
+    }
 
-        if (deleted_order->type() == ICEBERG_ORDER) {
-          std::shared_ptr<IcebergOrder> iceberg_deleted_order = std::static_pointer_cast<IcebergOrder>(deleted_order);
-          uint32_t new_quantity = std::min(iceberg_deleted_order->hidden_full_volume(), iceberg_deleted_order->peak_size());
-          iceberg_deleted_order->mutable_quantity() = new_quantity;
-          Add(iceberg_deleted_order);
+    // Highest non-empty level strictly below `price`.
+    std::optional<uint16_t> NextBelow(uint32_t price) const {
+        if (price == 0) {
+            return std::nullopt;
+        }
+        uint32_t from = std::min(price - 1, kLevels - 1);
+        uint64_t bits = Word(from >> 6) & (~uint64_t{0} >> (63 - (from & 63)));
+        if (bits) {
+            return static_cast<uint16_t>((from & ~63u) + 63 - std::countl_zero(bits));
+        }
+        for (int32_t word = static_cast<int32_t>(from >> 6) - 1; word >= 0; ) {
+            uint64_t summary_bits = summary_[word >> 6] & (~uint64_t{0} >> (63 - (word & 63)));
+            if (summary_bits) {
+                uint32_t found_word = (word & ~63) + 63 - std::countl_zero(summary_bits);
+                return static_cast<uint16_t>((found_word << 6) + 63 - std::countl_zero(Word(found_word)));
+            }
+            word = (word & ~63) - 1;
         }
+        return std::nullopt;
     }
 
-    std::string ToString() const {
-        std::ostringstream result;
-
-        // Header
-        result << "+-----------------------------------------------------------------+\n";
-        result << "| BUY                            | SELL                           |\n";
-        result << "| Id       | Volume      | Price | Price | Volume      | Id       |\n";
-        result << "+----------+-------------+-------+-------+-------------+----------+\n";
-        
-        // Data rows
-        std::reverse_iterator<OrderBookType::const_iterator> buys_iterator = buys_book_.rbegin();
-        std::optional<ListType::const_iterator> buys_list_iterator = std::nullopt;
-        OrderBookType::const_iterator sells_iterator = sells_book_.begin(); 
-        std::optional<ListType::const_iterator> sells_list_iterator = std::nullopt;
-
-        if (buys_iterator != buys_book_.rend()) {
-            buys_list_iterator.emplace(buys_iterator->second.begin());
-        }
-
-        if (sells_iterator != sells_book_.end()) {
-            sells_list_iterator.emplace(sells_iterator->second.begin());
-        }
-
-        auto moveIterator = [](auto&& list_iterator, auto&& book_iterator, auto&& order_book_finish) {
-            if (list_iterator) {
-                list_iterator.value()++;
-                if (list_iterator == book_iterator->second.end()) {
-                    book_iterator++;
-                    if (book_iterator == order_book_finish) {
-                        list_iterator.reset();
-                    } else {
-                        list_iterator.emplace(book_iterator->second.begin());
-                    }
-                }
-            }
-        };
+private:
+    static constexpr uint32_t kWords = kLevels / 64;
 
-        auto formatWithThousandSeparator = [](int64_t number) {
-            std::string number_str = absl::StrCat(number);
-            std::reverse(number_str.begin(), number_str.end()); 
-            std::vector<std::string> groups = absl::StrSplit(number_str, absl::ByLength(3));
-            std::string formatted_number = absl::StrJoin(groups, ",");
-            std::reverse(formatted_number.begin(), formatted_number.end());
-            return formatted_number;
-        };
+    using Chunk = std::array<uint64_t, 64>;
 
+    static uint64_t Bit(uint32_t index) {
+        return uint64_t{1} << (index & 63);
+    }
 
-        auto printBuysIterator = [&result, &formatWithThousandSeparator](auto&& list_iterator)  {
-            if (list_iterator) {
-                auto&& order = list_iterator.value()->get();
-                result << absl::StrFormat("%10d|%13s|%7s", order->id(), formatWithThousandSeparator(order->quantity()), formatWithThousandSeparator(order->price()));
-            } else {
-                result << absl::StrFormat("%10s|%13s|%7s", "", "", "");
-            }
-        };
+    uint64_t Word(uint32_t index) const {
+        const std::unique_ptr<Chunk>& chunk = chunks_[index >> 6];
+        return chunk ? (*chunk)[index & 63] : 0;
+    }
 
-        auto printSellsIterator = [&result, &formatWithThousandSeparator](auto&& list_iterator)  {
-            if (list_iterator) {
-                auto&& order = list_iterator.value()->get();
-                result << absl::StrFormat("%7s|%13s|%10d",  formatWithThousandSeparator(order->price()), formatWithThousandSeparator(order->quantity()), order->id());
-            } else {
-                result << absl::StrFormat("%7s|%13s|%10s", "", "", "");
-            }
-        };
-        
+    std::array<std::unique_ptr<Chunk>, kWords / 64> chunks_;
+    std::array<uint64_t, kWords / 64> summary_{};
+    uint32_t allocated_chunks_ = 0;
+};
 
-        while (buys_list_iterator || sells_list_iterator) {
-            result << '|';
-            printBuysIterator(buys_list_iterator);
-            result << '|';
-            printSellsIterator(sells_list_iterator);
-            result << "|\n";
 
-            moveIterator(buys_list_iterator, buys_iterator, buys_book_.rend());            
-            moveIterator(sells_list_iterator, sells_iterator, sells_book_.end());
-        }
+// Binary indexed (Fenwick) tree of level volumes and notionals over the price
+// domain, in two tiers: a tree over each page of kPageSize indices, allocated
+// on the first update in it, and a tree over the page totals. Point updates,
+// prefix sums and the search for the first prefix reaching a volume walk one
+// path in each, log2(kSize) = 16 steps in all, and both sums share a node.
+// Updates are modulo 2^64, so negative deltas work as long as every sum stays
+// non-negative.
+class DepthTree {
+public:
+    static constexpr uint32_t kSize = PriceLevelBitmap::kLevels;
+    static constexpr uint32_t kPageSize = 256;
 
-        // Footer
-        result << "+-----------------------------------------------------------------+\n";  
+    struct Sums {
+        uint64_t volume = 0;
+        uint64_t notional = 0;  // Sum of price * volume.
+    };
 
-        return result.str();
+    void Add(uint32_t index, uint64_t volume, uint64_t notional) {
+        Allocate(index);
+        pages_[index / kPageSize]->Add(index % kPageSize, volume, notional);
+        pages_total_.Add(index / kPageSize, volume, notional);
     }
 
-    friend std::ostream& operator<< (std::ostream& out, const OrderBook& order_book) {
-        out << order_book.ToString();
-        return out;
+    // Sums over [0, index].
+    Sums PrefixSum(uint32_t index) const {
+        Sums sums;
+        if (index >= kPageSize) {
+            sums = pages_total_.PrefixSum(index / kPageSize - 1);
+        }
+        if (const std::unique_ptr<Tree>& page = pages_[index / kPageSize]) {
+            Sums within = page->PrefixSum(index % kPageSize);
+            sums.volume += within.volume;
+            sums.notional += within.notional;
+        }
+        return sums;
+    }
+
+    uint64_t TotalVolume() const {
+        return pages_total_.TotalVolume();
     }
-};
 
+    // Smallest index whose prefix volume is at least `volume`, or kSize if the
+    // total is below it; `before` gets the sums over [0, index).
+    uint32_t LowerBound(uint64_t volume, Sums* before) const {
+        uint32_t page = pages_total_.LowerBound(volume, before);
+        if (page == kPages) {
+            return kSize;
+        }
+        if (!pages_[page]) {
+            return page * kPageSize;  // Only for a volume of zero.
+        }
+        Sums within;
+        uint32_t index = page * kPageSize + pages_[page]->LowerBound(volume - before->volume, &within);
+        before->volume += within.volume;
+        before->notional += within.notional;
+        return index;
+    }
 
-class MatchingSystem {
-public:
-    void AddOrder(std::shared_ptr<LimitOrder> order) {
-        if (order->type() == ICEBERG_ORDER) {
-            std::shared_ptr<IcebergOrder> iceberg_order = std::static_pointer_cast<IcebergOrder>(order);
-            ProcessIcebergOrder(iceberg_order);
-        } else if (order->type() == LIMIT_ORDER) {
-            ProcessLimitOrder(order);
-        } else { // Unknown
-            LOG(FATAL) << absl::StrFormat("Error during AddOrder, type of order is not supported %s", OrderType_Name(order->type()));
+    // Allocates the page holding `index` ahead of its first update.
+    void Allocate(uint32_t index) {
+        if (!pages_[index / kPageSize]) {
+            pages_[index / kPageSize] = std::make_unique<Tree>();
+            ++allocated_pages_;
         }
+    }
 
-        std::cout << order_book_;
+    size_t memory_bytes() const {
+        return sizeof(*this) + allocated_pages_ * sizeof(Tree);
     }
 
 private:
-    
-    template<typename T>
-    std::enable_if_t<std::is_base_of_v<LimitOrder, T>, void> ProcessOrder(std::shared_ptr<T> order) {
-        while (order->quantity() && order_book_.GetOpposite(order->side()) && LimitOrder::MatchesPrice(order, order_book_.GetOpposite(order->side()).value())) {
-            auto opposite_order = order_book_.GetOpposite(order->side()).value();
-            uint32_t price = LimitOrder::CalculatePrice(order, opposite_order);
-            uint32_t quantity = std::min(order->quantity(), opposite_order->quantity());
-            opposite_order->Fill(quantity);
-            order->Fill(quantity);
-            
-            trades_manager_.Append(order->id(), opposite_order->id(), order->side(), price, quantity);
-    
-            if (opposite_order->quantity() == 0) {
-                order_book_.PopOpposite(order->side());
+    static constexpr uint32_t kPages = kSize / kPageSize;
+    static_assert(kPages == kPageSize, "Both tiers share one tree size");
+
+    // The plain Fenwick tree of one tier, over kPageSize indices.
+    class Tree {
+    public:
+        void Add(uint32_t index, uint64_t volume, uint64_t notional) {
+            for (uint32_t node = index + 1; node <= kPageSize; node += node & -node) {
+                nodes_[node].volume += volume;
+                nodes_[node].notional += notional;
             }
         }
-    }
 
-    void ProcessLimitOrder(std::shared_ptr<LimitOrder> order)  {
-        ProcessOrder(order);
-        trades_manager_.NotifyAll();
-        order_book_.Add(order);
+        Sums PrefixSum(uint32_t index) const {
+            Sums sums;
+            for (uint32_t node = index + 1; node > 0; node &= node - 1) {
+                sums.volume += nodes_[node].volume;
+                sums.notional += nodes_[node].notional;
+            }
+            return sums;
+        }
+
+        uint64_t TotalVolume() const {
+            return nodes_[kPageSize].volume;
+        }
+
+        uint32_t LowerBound(uint64_t volume, Sums* before) const {
+            *before = {};
+            uint32_t node = 0;
+            for (uint32_t step = kPageSize; step > 0; step >>= 1) {
+                if (node + step <= kPageSize && before->volume + nodes_[node + step].volume < volume) {
+                    node += step;
+                    before->volume += nodes_[node].volume;
+                    before->notional += nodes_[node].notional;
+                }
+            }
+            return node;
+        }
+
+    private:
+        std::array<Sums, kPageSize + 1> nodes_{};
+    };
+
+    Tree pages_total_;
+    std::array<std::unique_ptr<Tree>, kPages> pages_;
+    uint32_t allocated_pages_ = 0;
+};
+
+
+// Cost of taking a quantity from one side of the book, best prices first.
+struct FillEstimate {
+    uint64_t quantity = 0;     // Available part of the requested quantity.
+    uint64_t notional = 0;     // Sum of price * quantity over the levels taken.
+    uint16_t worst_price = 0;  // Last level taken from; 0 if nothing is available.
+
+    double vwap() const {
+        return quantity ? static_cast<double>(notional) / quantity : 0;
     }
+};
+
 
-    void ProcessIcebergOrder(std::shared_ptr<IcebergOrder> order) {
-        order->mutable_quantity() = order->hidden_full_volume();
+// What happens when an aggressive order meets a resting order of the same
+// non-zero participant.
+enum class SelfTradePrevention : uint8_t {
+    kNone,           // They trade.
+    kCancelNewest,   // The rest of the aggressive order is cancelled.
+    kCancelOldest,   // The resting order is cancelled and matching goes on.
+    kDecrementBoth,  // Both lose the smaller of their quantities without a trade.
+};
+
+// What one OrderBook::Sweep did.
+struct SweepStats {
+    uint32_t levels = 0;
+    uint32_t fills = 0;
+    uint32_t replenishments = 0;
+    uint32_t self_trades_prevented = 0;
+    uint32_t decremented_quantity = 0;  // Taken from the aggressor by kDecrementBoth.
+    bool aggressor_cancelled = false;   // By kCancelNewest.
+};
 
-        ProcessOrder(order);
-        
-        order->mutable_quantity() = std::min(order->peak_size(), order->hidden_full_volume());
 
-        trades_manager_.NotifyAll();
-        order_book_.Add(order);
+// One side of the book: FIFO queues indexed by price, a bitmap of non-empty
+// levels and a cursor on the best level. The queues come in pages of
+// kPageLevels prices, and the bitmap and depth tree in chunks, each allocated
+// when a price in it is first used, so a book costs what its prices need
+// rather than the whole price domain. Orders are linked into their level
+// intrusively and live in the OrderPool shared by both sides.
+template <OrderSide kSide>
+class BookSide {
+public:
+    struct PriceLevel {
+        OrderHandle head = kNullOrderHandle;
+        OrderHandle tail = kNullOrderHandle;
+        uint32_t order_count = 0;
+        uint32_t touched_epoch = 0;  // See MarkTouched(); fills what would be padding.
+        uint64_t volume = 0;        // Visible quantity of the resting orders.
+        uint64_t total_volume = 0;  // Including the hidden volume of icebergs.
+
+        bool empty() const {
+            return head == kNullOrderHandle;
+        }
+    };
+
+    static constexpr uint32_t kPageLevels = 256;
+
+    explicit BookSide(OrderPool& pool) : pool_(pool) {
+    }
+
+    bool empty() const {
+        return !best_price_;
+    }
+
+    std::optional<uint16_t> best_price() const {
+        return best_price_;
+    }
+
+    OrderHandle Front() const {
+        return LevelAt(*best_price_).head;
+    }
+
+    void Push(OrderHandle handle) {
+        LimitOrder& order = pool_[handle];
+        uint16_t price = order.price();
+        PriceLevel& level = AllocatedLevel(price);
+        order.prev_ = level.tail;
+        order.next_ = kNullOrderHandle;
+        ++level.order_count;
+        level.volume += order.quantity();
+        level.total_volume += order.hidden_full_volume();
+        AddDepth(price, order.hidden_full_volume());
+        if (level.empty()) {
+            level.head = handle;
+            ++level_count_;
+            bitmap_.Set(price);
+            if (!best_price_ || IsBetter(price, *best_price_)) {
+                best_price_ = price;
+            }
+        } else {
+            pool_[level.tail].next_ = handle;
+        }
+        level.tail = handle;
+    }
+
+    OrderHandle PopFront() {
+        OrderHandle handle = Front();
+        Remove(handle);
+        return handle;
+    }
+
+    void Remove(OrderHandle handle) {
+        LimitOrder& order = pool_[handle];
+        uint16_t price = order.price();
+        PriceLevel& level = LevelAt(price);
+        if (order.prev_ != kNullOrderHandle) {
+            pool_[order.prev_].next_ = order.next_;
+        } else {
+            level.head = order.next_;
+        }
+        if (order.next_ != kNullOrderHandle) {
+            pool_[order.next_].prev_ = order.prev_;
+        } else {
+            level.tail = order.prev_;
+        }
+        --level.order_count;
+        level.volume -= order.quantity();
+        level.total_volume -= order.hidden_full_volume();
+        AddDepth(price, -uint64_t{order.hidden_full_volume()});
+        if (level.empty()) {
+            --level_count_;
+            bitmap_.Reset(price);
+            if (price == *best_price_) {
+                best_price_ = NextLevel(price);
+            }
+        }
+    }
+
+    // Fills the aggressive `order` against every level it crosses, best first,
+    // until it is filled or nothing crosses. A level is consumed in one pass:
+    // exhausted orders are unlinked from the head, replenished icebergs go to
+    // the tail, and the aggregates, bitmap and best price are updated once per
+    // level. Calls on_level(price) before a level changes, on_fill(resting,
+    // quantity, handle) for each fill and on_exhausted(handle) for each order
+    // leaving the book, which may release it. Resting orders of `participant`
+    // are handled as kStp says; with kNone the check is compiled out.
+    template <SelfTradePrevention kStp, typename OnLevel, typename OnFill, typename OnExhausted>
+    SweepStats Sweep(LimitOrder& order, uint32_t participant, OnLevel&& on_level, OnFill&& on_fill, OnExhausted&& on_exhausted) {
+        SweepStats stats;
+        while (order.quantity() && best_price_ && !IsBetter(order.price(), *best_price_)) {
+            uint16_t price = *best_price_;
+            PriceLevel& level = LevelAt(price);
+            on_level(price);
+            ++stats.levels;
+            uint64_t filled = 0;  // Includes quantities decremented without a trade.
+            uint64_t shown = 0;
+            uint64_t cancelled = 0;
+            uint64_t cancelled_total = 0;
+            uint32_t removed = 0;
+            while (order.quantity() && !level.empty()) {
+                OrderHandle handle = level.head;
+                LimitOrder& resting = pool_[handle];
+                uint32_t quantity = std::min(order.quantity(), resting.quantity());
+                bool self_trade = false;
+                if constexpr (kStp != SelfTradePrevention::kNone) {
+                    self_trade = participant != 0 && pool_.participant(handle) == participant;
+                    if (self_trade) {
+                        ++stats.self_trades_prevented;
+                        if constexpr (kStp == SelfTradePrevention::kCancelNewest) {
+                            stats.aggressor_cancelled = true;
+                            break;
+                        } else if constexpr (kStp == SelfTradePrevention::kCancelOldest) {
+                            cancelled += resting.quantity();
+                            cancelled_total += resting.hidden_full_volume();
+                            ++removed;
+                            UnlinkHead(level, resting);
+                            on_exhausted(handle);
+                            continue;
+                        } else {
+                            resting.Fill(quantity);
+                            order.Fill(quantity);
+                            filled += quantity;
+                            stats.decremented_quantity += quantity;
+                        }
+                    }
+                }
+                if (!self_trade) {
+                    resting.Fill(quantity);
+                    order.Fill(quantity);
+                    filled += quantity;
+                    ++stats.fills;
+                    on_fill(std::as_const(resting), quantity, handle);
+                }
+                if (resting.quantity()) {
+                    break;
+                }
+                UnlinkHead(level, resting);
+                if (uint32_t peak = resting.Replenish()) {
+                    shown += peak;
+                    ++stats.replenishments;
+                    resting.prev_ = level.tail;
+                    resting.next_ = kNullOrderHandle;
+                    if (level.empty()) {
+                        level.head = handle;
+                    } else {
+                        pool_[level.tail].next_ = handle;
+                    }
+                    level.tail = handle;
+                } else {
+                    ++removed;
+                    on_exhausted(handle);
+                }
+            }
+            level.volume = level.volume + shown - filled - cancelled;
+            level.total_volume -= filled + cancelled_total;
+            AddDepth(price, -(filled + cancelled_total));
+            level.order_count -= removed;
+            if (!level.empty()) {
+                break;
+            }
+            --level_count_;
+            bitmap_.Reset(price);
+            best_price_ = NextLevel(price);
+        }
+        return stats;
+    }
+
+    // Lowers the remaining volume of a resting order without moving it; the
+    // visible part shrinks only if it exceeds what is left.
+    void Reduce(OrderHandle handle, uint32_t remaining_volume) {
+        LimitOrder& order = pool_[handle];
+        PriceLevel& level = LevelAt(order.price());
+        uint32_t quantity = std::min(order.quantity(), remaining_volume);
+        level.volume = level.volume - order.quantity() + quantity;
+        level.total_volume = level.total_volume - order.hidden_full_volume() + remaining_volume;
+        AddDepth(order.price(), uint64_t{remaining_volume} - order.hidden_full_volume());
+        order.mutable_quantity() = quantity;
+        order.mutable_hidden_full_volume() = remaining_volume;
+    }
+
+    // Whether the levels `order` crosses hold at least `quantity`, hidden
+    // volume included.
+    bool CanFill(const LimitOrder& order, uint64_t quantity) const {
+        return depth_.PrefixSum(DepthIndex(order.price())).volume >= quantity;
+    }
+
+    // CanFill for an aggressor of `participant` that Sweep<kStp> would not
+    // fill against its own orders: with kCancelOldest their volume does not
+    // count, otherwise nothing from the first of them on does. After the
+    // O(log levels) CanFill check this walks the crossed orders in sweep
+    // order and stops as soon as `quantity` is covered, so it costs one step
+    // per order the FOK order would trade with or skip, not per resting order.
+    template <SelfTradePrevention kStp>
+    bool CanFillWithoutSelfTrade(const LimitOrder& order, uint32_t participant, uint64_t quantity) const {
+        if (!CanFill(order, quantity)) {
+            return false;
+        }
+        if (participant == 0) {
+            return true;
+        }
+        uint64_t fillable = 0;
+        for (std::optional<uint16_t> price = best_price_; price && !IsBetter(order.price(), *price); price = NextLevel(*price)) {
+            const PriceLevel& level = LevelAt(*price);
+            // What the sweep takes from this level before an own order: all
+            // of it with kCancelOldest, otherwise the visible part only, as
+            // icebergs refill behind the own order.
+            uint64_t taken = 0;
+            for (OrderHandle handle = level.head; handle != kNullOrderHandle; handle = Next(handle)) {
+                if (pool_.participant(handle) == participant) {
+                    if constexpr (kStp != SelfTradePrevention::kCancelOldest) {
+                        return false;
+                    }
+                    continue;
+                }
+                taken += kStp == SelfTradePrevention::kCancelOldest ? pool_[handle].hidden_full_volume() : pool_[handle].quantity();
+                if (fillable + taken >= quantity) {
+                    return true;
+                }
+            }
+            fillable += kStp == SelfTradePrevention::kCancelOldest ? taken : level.total_volume;
+            if (fillable >= quantity) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Volume, hidden included, at most `ticks` behind the best price.
+    uint64_t VolumeWithin(uint16_t ticks) const {
+        if (!best_price_) {
+            return 0;
+        }
+        return depth_.PrefixSum(std::min(DepthIndex(*best_price_) + ticks, DepthTree::kSize - 1)).volume;
+    }
+
+    // Cost of taking `quantity` from this side, hidden volume included.
+    FillEstimate EstimateFill(uint64_t quantity) const {
+        FillEstimate estimate;
+        estimate.quantity = std::min(quantity, depth_.TotalVolume());
+        if (estimate.quantity == 0) {
+            return estimate;
+        }
+        DepthTree::Sums before;
+        estimate.worst_price = DepthPrice(depth_.LowerBound(estimate.quantity, &before));
+        estimate.notional = before.notional + (estimate.quantity - before.volume) * estimate.worst_price;
+        return estimate;
+    }
+
+    // An empty level for prices whose page was never allocated.
+    const PriceLevel& level(uint16_t price) const {
+        static constexpr PriceLevel kEmpty;
+        const std::unique_ptr<LevelPage>& page = pages_[price / kPageLevels];
+        return page ? (*page)[price % kPageLevels] : kEmpty;
+    }
+
+    // Records that the level changed during market-data epoch `epoch`; returns
+    // false if it already had. The level is about to change, so its page is
+    // allocated here if need be.
+    bool MarkTouched(uint16_t price, uint32_t epoch) {
+        uint32_t& touched_epoch = AllocatedLevel(price).touched_epoch;
+        if (touched_epoch == epoch) {
+            return false;
+        }
+        touched_epoch = epoch;
+        return true;
+    }
+
+    // Sets every level's market-data epoch back to zero.
+    void ResetTouchedEpochs() {
+        for (std::unique_ptr<LevelPage>& page : pages_) {
+            if (page) {
+                for (PriceLevel& level : *page) {
+                    level.touched_epoch = 0;
+                }
+            }
+        }
+    }
+
+    // Allocates the storage of every price in [low, high] ahead of its first
+    // use, so that orders at those prices never allocate.
+    void ReservePrices(uint16_t low, uint16_t high) {
+        for (uint32_t price = low; price <= high; price = (price / kPageLevels + 1) * kPageLevels) {
+            AllocatedLevel(static_cast<uint16_t>(price));
+            bitmap_.Allocate(static_cast<uint16_t>(price));
+            depth_.Allocate(DepthIndex(static_cast<uint16_t>(price)));
+        }
+    }
+
+    // Number of non-empty levels.
+    uint32_t level_count() const {
+        return level_count_;
+    }
+
+    // Grows as prices in new pages are first used, never shrinks.
+    size_t memory_bytes() const {
+        return sizeof(pages_) + allocated_pages_ * sizeof(LevelPage) + bitmap_.memory_bytes() + depth_.memory_bytes();
+    }
+
+    OrderHandle Next(OrderHandle handle) const {
+        return pool_[handle].next_;
+    }
+
+    // Next non-empty level behind `price` in priority order.
+    std::optional<uint16_t> NextLevel(uint16_t price) const {
+        if constexpr (kSide == BUY_OS) {
+            return bitmap_.NextBelow(price);
+        } else {
+            return bitmap_.NextAbove(price);
+        }
+    }
+
+private:
+    static bool IsBetter(uint16_t price, uint16_t other_price) {
+        return kSide == BUY_OS ? price > other_price : price < other_price;
+    }
+
+    // The depth trees are indexed by priority, best prices first, so both
+    // sides answer "up to this price" with a prefix sum.
+    static uint32_t DepthIndex(uint16_t price) {
+        return kSide == BUY_OS ? DepthTree::kSize - 1 - price : price;
+    }
+
+    static uint16_t DepthPrice(uint32_t index) {
+        return static_cast<uint16_t>(kSide == BUY_OS ? DepthTree::kSize - 1 - index : index);
+    }
+
+    // Called with every change of a level's total volume.
+    void AddDepth(uint16_t price, uint64_t delta) {
+        depth_.Add(DepthIndex(price), delta, delta * price);
+    }
+
+    using LevelPage = std::array<PriceLevel, kPageLevels>;
+
+    // The level of a price whose page exists, such as any non-empty one.
+    PriceLevel& LevelAt(uint16_t price) {
+        return (*pages_[price / kPageLevels])[price % kPageLevels];
+    }
+
+    const PriceLevel& LevelAt(uint16_t price) const {
+        return (*pages_[price / kPageLevels])[price % kPageLevels];
+    }
+
+    PriceLevel& AllocatedLevel(uint16_t price) {
+        std::unique_ptr<LevelPage>& page = pages_[price / kPageLevels];
+        if (!page) {
+            page = std::make_unique<LevelPage>();
+            ++allocated_pages_;
+        }
+        return (*page)[price % kPageLevels];
+    }
+
+    // Unlinks the head of `level`, leaving the aggregates to the caller.
+    void UnlinkHead(PriceLevel& level, const LimitOrder& head) {
+        level.head = head.next_;
+        if (level.head != kNullOrderHandle) {
+            pool_[level.head].prev_ = kNullOrderHandle;
+        } else {
+            level.tail = kNullOrderHandle;
+        }
+    }
+
+    OrderPool& pool_;
+    std::array<std::unique_ptr<LevelPage>, PriceLevelBitmap::kLevels / kPageLevels> pages_;
+    uint32_t allocated_pages_ = 0;
+    PriceLevelBitmap bitmap_;
+    DepthTree depth_;  // Total volume of each level, indexed by DepthIndex().
+    std::optional<uint16_t> best_price_;
+    uint32_t level_count_ = 0;
+};
+
+
+struct OrderBookStats {
+    // Totals since the book was created.
+    uint64_t levels_swept = 0;
+    uint64_t fills = 0;
+    uint64_t iceberg_replenishments = 0;
+    uint64_t self_trades_prevented = 0;
+    // Current state.
+    uint64_t resting_orders = 0;
+    uint32_t bid_levels = 0;
+    uint32_t ask_levels = 0;
+    uint64_t allocated_slabs = 0;  // Each holds OrderPool::kSlabSize orders.
+};
+
+
+// Aggregate of the orders resting at one price.
+struct BookLevel {
+    OrderSide side;
+    uint16_t price;
+    uint32_t order_count;
+    uint64_t volume;
+
+    bool operator==(const BookLevel&) const = default;
+};
+
+struct LevelDelta {
+    enum class Kind : uint8_t {
+        kAdd,
+        kUpdate,
+        kDelete,  // `level` holds zero volume and orders.
+    };
+
+    Kind kind;
+    BookLevel level;
+};
+
+struct BestBidOffer {
+    std::optional<BookLevel> bid;
+    std::optional<BookLevel> ask;
+
+    bool operator==(const BestBidOffer&) const = default;
+};
+
+// Receives the changes of an OrderBook. After each event every touched level
+// is reported once with its final state, followed by the top of book if it
+// changed. Combined with a Depth() snapshot taken when subscribing, the deltas
+// reproduce the book's price levels.
+class MarketDataSubscriber {
+public:
+    virtual void OnLevelDelta(const LevelDelta& delta) = 0;
+
+    virtual void OnBestBidOffer(const BestBidOffer& best) {
+    }
+
+    virtual ~MarketDataSubscriber() = default;
+};
+
+
+// Heap memory held by a MatchingSystem, in bytes.
+struct MemoryStats {
+    size_t order_capacity = 0;  // Resting orders that fit without allocating; not bytes.
+    size_t order_pool = 0;
+    size_t order_index = 0;
+    size_t price_ladders = 0;   // Levels, bitmaps and depth trees of both sides.
+    size_t market_data = 0;
+    size_t pending_trades = 0;
+    size_t participants = 0;
+
+    size_t total() const {
+        return order_pool + order_index + price_ladders + market_data + pending_trades + participants;
+    }
+
+    std::string ToString() const {
+        return absl::StrFormat("memory_bytes(total=%u orders=%u index=%u ladders=%u market_data=%u trades=%u participants=%u) order_capacity=%u",
+                               total(), order_pool, order_index, price_ladders, market_data, pending_trades, participants, order_capacity);
+    }
+};
+
+
+class OrderBook {
+    OrderPool pool_;
+    BookSide<SELL_OS> sells_book_{pool_};
+    BookSide<BUY_OS> buys_book_{pool_};
+    absl::flat_hash_map<uint32_t, OrderHandle> index_;
+    MarketDataSubscriber* subscriber_ = nullptr;
+    // Levels changed since the last PublishMarketData(), as they were before the change.
+    std::vector<BookLevel> touched_levels_;
+    // Tags the levels in touched_levels_; bumped whenever it is cleared.
+    uint32_t touched_epoch_ = 1;
+    // Levels touched_levels_ holds before market data is published early.
+    size_t touched_level_limit_ = std::numeric_limits<size_t>::max();
+    // Calls to Touch(), with or without a subscriber; see level_changes().
+    uint64_t level_changes_ = 0;
+    BestBidOffer published_best_;
+    OrderBookStats totals_;
+public:
+
+    LimitOrder* GetOpposite(const OrderSide& order_side) {
+        return const_cast<LimitOrder*>(std::as_const(*this).GetOpposite(order_side));
+    }
+
+    const LimitOrder* GetOpposite(const OrderSide& order_side) const {
+        if  (order_side == SELL_OS) {
+            if (buys_book_.empty()) {
+                return nullptr;
+            }
+            return &pool_[buys_book_.Front()];
+        } else if (order_side == BUY_OS) {
+            if (sells_book_.empty()) {
+                return nullptr;
+            }
+            return &pool_[sells_book_.Front()];
+        } else {
+            LOG(FATAL) << absl::StrFormat("OrderSide is not supported %s", OrderSide_Name(order_side));
+            return nullptr;
+        }
+    }
+
+    void Add(const LimitOrder& order, uint32_t participant = 0) {
+        if (order.quantity() == 0) {
+            return;
+        }
+        auto opposite_order = GetOpposite(order.side());
+        if (opposite_order && LimitOrder::MatchesPrice(order, *opposite_order)) {
+            LOG(FATAL) << absl::StrFormat("Adding order with price %hu while exists opposite order with price: %hu", order.price(), opposite_order->price());
+        }
+        OrderHandle handle = pool_.Emplace(order, participant);
+        if (!index_.try_emplace(order.id(), handle).second) {
+            pool_.Release(handle);
+            LOG(FATAL) << absl::StrFormat("Adding order with id %u while an order with the same id is resting", order.id());
+        }
+        Touch(order.side(), order.price());
+        Push(handle);
+    }
+
+    // Matches `order` against the opposite side as far as its price allows and
+    // calls on_fill(resting_order, quantity, pending_trade) for every fill in
+    // priority order. `pending_trade` is the resting order's slot for
+    // TradeManager::Append. Filled orders leave the book; icebergs come back
+    // with their next peak.
+    template <typename OnFill>
+    SweepStats Sweep(LimitOrder& order, OnFill&& on_fill) {
+        return SweepSide<SelfTradePrevention::kNone>(order, 0, [&](const LimitOrder& resting, uint32_t quantity, OrderHandle handle) {
+            on_fill(resting, quantity, pool_.pending_trade(handle));
+        });
+    }
+
+    // Like Sweep(order, on_fill), for an order of `participant`: resting orders
+    // of the same participant are handled as kStp says, and the callback is
+    // on_fill(resting_order, quantity, pending_trade, resting_participant).
+    template <SelfTradePrevention kStp, typename OnFill>
+    SweepStats Sweep(LimitOrder& order, uint32_t participant, OnFill&& on_fill) {
+        return SweepSide<kStp>(order, participant, [&](const LimitOrder& resting, uint32_t quantity, OrderHandle handle) {
+            on_fill(resting, quantity, pool_.pending_trade(handle), pool_.participant(handle));
+        });
+    }
+
+    void PopOpposite(const OrderSide& order_side) {
+        OrderHandle deleted_handle = kNullOrderHandle;
+        if (const LimitOrder* opposite_order = GetOpposite(order_side)) {
+            Touch(opposite_order->side(), opposite_order->price());
+        }
+
+        if  (order_side == SELL_OS) {
+            deleted_handle = buys_book_.PopFront();
+        } else if (order_side == BUY_OS) {
+            deleted_handle = sells_book_.PopFront();
+        }
+
+        LimitOrder& deleted_order = pool_[deleted_handle];
+        if (deleted_order.Replenish()) {
+            ++totals_.iceberg_replenishments;
+            Push(deleted_handle);
+            return;
+        }
+        index_.erase(deleted_order.id());
+        pool_.Release(deleted_handle);
+    }
+
+    bool Cancel(uint32_t id) {
+        auto it = index_.find(id);
+        if (it == index_.end()) {
+            return false;
+        }
+        OrderHandle handle = it->second;
+        index_.erase(it);
+        Touch(pool_[handle].side(), pool_[handle].price());
+        Unlink(handle);
+        pool_.Release(handle);
+        return true;
+    }
+
+    // Lowers the remaining volume of a resting order in place, keeping its time priority.
+    bool Reduce(uint32_t id, uint32_t quantity) {
+        auto it = index_.find(id);
+        if (it == index_.end()) {
+            return false;
+        }
+        const LimitOrder& order = pool_[it->second];
+        if (quantity == 0 || quantity > RemainingVolume(order)) {
+            LOG(FATAL) << absl::StrFormat("Reduce of order %u to %u is not a reduction of %u", id, quantity, RemainingVolume(order));
+        }
+        Touch(order.side(), order.price());
+        if (order.side() == SELL_OS) {
+            sells_book_.Reduce(it->second, quantity);
+        } else {
+            buys_book_.Reduce(it->second, quantity);
+        }
+        return true;
+    }
+
+    // Volume resting on `side` at most `ticks` behind its best price, hidden
+    // volume included. O(log P) in the number of prices.
+    uint64_t VolumeWithin(OrderSide side, uint16_t ticks) const {
+        return side == SELL_OS ? sells_book_.VolumeWithin(ticks) : buys_book_.VolumeWithin(ticks);
+    }
+
+    // What an aggressive order of `side` for `quantity` would pay, ignoring its
+    // limit price: the volume it could take, the notional and the worst level.
+    // O(log P); use FillEstimate::vwap() for the average price.
+    FillEstimate EstimateFill(OrderSide side, uint64_t quantity) const {
+        return side == BUY_OS ? sells_book_.EstimateFill(quantity) : buys_book_.EstimateFill(quantity);
+    }
+
+    // Whether `order` would fill completely against the opposite side, hidden
+    // volume included. Costs O(log P) and changes nothing.
+    bool CanFill(const LimitOrder& order) const {
+        if (order.side() == BUY_OS) {
+            return sells_book_.CanFill(order, order.hidden_full_volume());
+        }
+        return buys_book_.CanFill(order, order.hidden_full_volume());
+    }
+
+    // Whether `order` from `participant` would fill completely under self-trade
+    // prevention mode kStp without the mode acting. Walks the crossed orders.
+    template <SelfTradePrevention kStp>
+    bool CanFillWithoutSelfTrade(const LimitOrder& order, uint32_t participant) const {
+        if (order.side() == BUY_OS) {
+            return sells_book_.template CanFillWithoutSelfTrade<kStp>(order, participant, order.hidden_full_volume());
+        }
+        return buys_book_.template CanFillWithoutSelfTrade<kStp>(order, participant, order.hidden_full_volume());
+    }
+
+    // Visible plus hidden volume still to be traded.
+    static uint32_t RemainingVolume(const LimitOrder& order) {
+        return order.hidden_full_volume();
+    }
+
+    const LimitOrder* Find(uint32_t id) const {
+        auto it = index_.find(id);
+        if (it == index_.end()) {
+            return nullptr;
+        }
+        return &pool_[it->second];
+    }
+
+    // Participant of a resting order; 0 if it is anonymous or not resting.
+    uint32_t Participant(uint32_t id) const {
+        auto it = index_.find(id);
+        return it == index_.end() ? 0 : pool_.participant(it->second);
+    }
+
+    size_t size() const {
+        return pool_.size();
+    }
+
+    OrderBookStats stats() const {
+        OrderBookStats stats = totals_;
+        stats.resting_orders = pool_.size();
+        stats.bid_levels = buys_book_.level_count();
+        stats.ask_levels = sells_book_.level_count();
+        stats.allocated_slabs = pool_.slab_count();
+        return stats;
+    }
+
+    // Makes room for `orders` more orders. The index gets a third more than
+    // that, so erased slots are reclaimed in place instead of by growing it.
+    void Reserve(size_t orders) {
+        pool_.Reserve(orders);
+        index_.reserve((index_.size() + orders) * 4 / 3);
+    }
+
+    // Allocates both sides' storage for prices in [low, high].
+    void ReservePrices(uint16_t low, uint16_t high) {
+        sells_book_.ReservePrices(low, high);
+        buys_book_.ReservePrices(low, high);
+    }
+
+    // Keeps touching levels free of allocations: once `levels` are waiting,
+    // market data is published before the next one is remembered, even in
+    // the middle of a sweep.
+    void ReserveTouchedLevels(size_t levels) {
+        touched_levels_.reserve(levels);
+        touched_level_limit_ = std::max<size_t>(levels, 1);
+    }
+
+    // Fills in the book's part of the engine's MemoryStats.
+    void AddMemoryStats(MemoryStats& stats) const {
+        stats.order_capacity = pool_.capacity();
+        stats.order_pool += pool_.memory_bytes();
+        stats.order_index += index_.capacity() * (sizeof(std::pair<uint32_t, OrderHandle>) + 1);
+        stats.price_ladders += sells_book_.memory_bytes() + buys_book_.memory_bytes();
+        stats.market_data += touched_levels_.capacity() * sizeof(BookLevel);
+    }
+
+    // Visits every resting order, the sell side first, each side from the best
+    // level and each level in time priority. Adding the orders to an empty book
+    // in this sequence rebuilds the same book. The visitor is called as
+    // visitor(order) or, if it takes two arguments, visitor(order, participant).
+    template <typename Visitor>
+    void ForEachOrder(Visitor&& visitor) const {
+        auto visit = [&](const auto& book_side) {
+            for (std::optional<uint16_t> price = book_side.best_price(); price; price = book_side.NextLevel(*price)) {
+                for (OrderHandle handle = book_side.level(*price).head; handle != kNullOrderHandle; handle = book_side.Next(handle)) {
+                    if constexpr (std::is_invocable_v<Visitor, const LimitOrder&, uint32_t>) {
+                        visitor(pool_[handle], pool_.participant(handle));
+                    } else {
+                        visitor(pool_[handle]);
+                    }
+                }
+            }
+        };
+        visit(sells_book_);
+        visit(buys_book_);
+    }
+
+    BookLevel Level(OrderSide side, uint16_t price) const {
+        auto summarize = [side, price](const auto& level) {
+            return BookLevel{.side = side, .price = price, .order_count = level.order_count, .volume = level.volume};
+        };
+        return side == SELL_OS ? summarize(sells_book_.level(price)) : summarize(buys_book_.level(price));
+    }
+
+    BestBidOffer BestPrices() const {
+        BestBidOffer best;
+        if (std::optional<uint16_t> price = buys_book_.best_price()) {
+            best.bid = Level(BUY_OS, *price);
+        }
+        if (std::optional<uint16_t> price = sells_book_.best_price()) {
+            best.ask = Level(SELL_OS, *price);
+        }
+        return best;
+    }
+
+    // The best `max_levels` levels of one side, best first. Costs O(max_levels)
+    // regardless of how many orders rest in the book.
+    std::vector<BookLevel> Depth(OrderSide side, size_t max_levels) const {
+        std::vector<BookLevel> depth;
+        auto collect = [&](const auto& book_side) {
+            for (std::optional<uint16_t> price = book_side.best_price(); price && depth.size() < max_levels; price = book_side.NextLevel(*price)) {
+                depth.push_back(Level(side, *price));
+            }
+        };
+        if (side == SELL_OS) {
+            collect(sells_book_);
+        } else {
+            collect(buys_book_);
+        }
+        return depth;
+    }
+
+    // Deltas are only tracked while a subscriber is set.
+    void set_market_data_subscriber(MarketDataSubscriber* subscriber) {
+        subscriber_ = subscriber;
+        ClearTouchedLevels();
+        published_best_ = BestPrices();
+    }
+
+    // Counts the level changes so far. A caller that sees it move knows the
+    // book changed; a level touched and then left as it was counts too.
+    uint64_t level_changes() const {
+        return level_changes_;
+    }
+
+    // Reports the levels changed since the previous call.
+    void PublishMarketData() {
+        if (!subscriber_) {
+            return;
+        }
+        for (const BookLevel& before : touched_levels_) {
+            BookLevel after = Level(before.side, before.price);
+            if (after == before) {
+                continue;
+            }
+            LevelDelta::Kind kind = LevelDelta::Kind::kUpdate;
+            if (before.order_count == 0) {
+                kind = LevelDelta::Kind::kAdd;
+            } else if (after.order_count == 0) {
+                kind = LevelDelta::Kind::kDelete;
+            }
+            subscriber_->OnLevelDelta(LevelDelta{.kind = kind, .level = after});
+        }
+        ClearTouchedLevels();
+        BestBidOffer best = BestPrices();
+        if (best != published_best_) {
+            published_best_ = best;
+            subscriber_->OnBestBidOffer(best);
+        }
+    }
+
+    // Copies the best `max_levels` levels of each side into `snapshot`, with
+    // their orders unless `with_orders` is false. Costs O(levels + orders
+    // copied) and reuses the snapshot's vectors; `sequence` is left as is.
+    void CaptureSnapshot(BookSnapshot& snapshot, size_t max_levels, bool with_orders = true) const {
+        auto capture = [&](const auto& book_side, BookSnapshot::Side& side) {
+            side.Clear();
+            for (std::optional<uint16_t> price = book_side.best_price(); price && side.levels.size() < max_levels; price = book_side.NextLevel(*price)) {
+                const auto& level = book_side.level(*price);
+                side.levels.push_back({.price = *price, .order_count = level.order_count, .volume = level.volume,
+                                       .total_volume = level.total_volume, .first_order = static_cast<uint32_t>(side.orders.size())});
+                if (!with_orders) {
+                    continue;
+                }
+                for (OrderHandle handle = level.head; handle != kNullOrderHandle; handle = book_side.Next(handle)) {
+                    const LimitOrder& order = pool_[handle];
+                    side.orders.push_back({.id = order.id(), .quantity = order.quantity(), .price = *price});
+                }
+            }
+        };
+        capture(buys_book_, snapshot.buys);
+        capture(sells_book_, snapshot.sells);
+    }
+
+    // Renders the orders of at most `max_levels` best price levels per side.
+    std::string ToString(size_t max_levels = PriceLevelBitmap::kLevels) const {
+        BookSnapshot snapshot;
+        CaptureSnapshot(snapshot, max_levels);
+        std::string result;
+        RenderTable(snapshot, result);
+        return result;
+    }
+
+    friend std::ostream& operator<< (std::ostream& out, const OrderBook& order_book) {
+        out << order_book.ToString();
+        return out;
+    }
+
+private:
+    // Sweeps the side opposite to `order`; on_fill gets the resting order's handle.
+    template <SelfTradePrevention kStp, typename OnFill>
+    SweepStats SweepSide(LimitOrder& order, uint32_t participant, OnFill&& on_fill) {
+        auto sweep = [&](auto& book_side, OrderSide resting_side) {
+            return book_side.template Sweep<kStp>(
+                order,
+                participant,
+                [&](uint16_t price) {
+                    Touch(resting_side, price);
+                },
+                on_fill,
+                [&](OrderHandle handle) {
+                    index_.erase(pool_[handle].id());
+                    pool_.Release(handle);
+                });
+        };
+        SweepStats stats = order.side() == BUY_OS ? sweep(sells_book_, SELL_OS) : sweep(buys_book_, BUY_OS);
+        totals_.levels_swept += stats.levels;
+        totals_.fills += stats.fills;
+        totals_.iceberg_replenishments += stats.replenishments;
+        totals_.self_trades_prevented += stats.self_trades_prevented;
+        return stats;
+    }
+
+    // Remembers the state of a level before its first change since market
+    // data was last published. O(1): the level carries the epoch it was
+    // last remembered in. Levels touched before are complete here, so a full
+    // reservation can be published on the spot.
+    void Touch(OrderSide side, uint16_t price) {
+        ++level_changes_;
+        if (!subscriber_) {
+            return;
+        }
+        if (touched_levels_.size() >= touched_level_limit_) {
+            PublishMarketData();
+        }
+        bool first = side == SELL_OS ? sells_book_.MarkTouched(price, touched_epoch_) : buys_book_.MarkTouched(price, touched_epoch_);
+        if (first) {
+            touched_levels_.push_back(Level(side, price));
+        }
+    }
+
+    void ClearTouchedLevels() {
+        touched_levels_.clear();
+        if (++touched_epoch_ == 0) {
+            // After 2^32 publications a stale tag could match again; start over.
+            sells_book_.ResetTouchedEpochs();
+            buys_book_.ResetTouchedEpochs();
+            touched_epoch_ = 1;
+        }
+    }
+
+    void Push(OrderHandle handle) {
+        if (pool_[handle].side() == SELL_OS) {
+            sells_book_.Push(handle);
+        } else {
+            buys_book_.Push(handle);
+        }
+    }
+
+    void Unlink(OrderHandle handle) {
+        if (pool_[handle].side() == SELL_OS) {
+            sells_book_.Remove(handle);
+        } else {
+            buys_book_.Remove(handle);
+        }
+    }
+};
+
+
+// What MatchingSystem writes after each event. Trades are reported in every mode,
+// to `out` unless a TradeSink is given to MatchingSystem.
+struct OutputPolicy {
+    enum class Mode {
+        kFullSnapshot,      // The whole book after every event.
+        kTopLevels,         // The best `depth` price levels per side after every event.
+        kPeriodicSnapshot,  // The whole book after every `interval` events.
+        kTradesOnly,
+    };
+
+    Mode mode = Mode::kFullSnapshot;
+    size_t depth = 0;
+    uint32_t interval = 1;
+    std::ostream* out = &std::cout;
+    // Merge fills between the same pair of orders within one aggressor order.
+    bool aggregate_trades = true;
+    // Writes MatchingStats::ToString() after every `stats_interval` events; 0 disables it.
+    uint64_t stats_interval = 0;
+    std::ostream* stats_out = &std::cerr;
+
+    static OutputPolicy FullSnapshot(std::ostream& out = std::cout) {
+        return {.mode = Mode::kFullSnapshot, .out = &out};
+    }
+
+    static OutputPolicy TopLevels(size_t depth, std::ostream& out = std::cout) {
+        return {.mode = Mode::kTopLevels, .depth = depth, .out = &out};
+    }
+
+    static OutputPolicy PeriodicSnapshot(uint32_t interval, std::ostream& out = std::cout) {
+        return {.mode = Mode::kPeriodicSnapshot, .interval = interval, .out = &out};
+    }
+
+    static OutputPolicy TradesOnly(std::ostream& out = std::cout) {
+        return {.mode = Mode::kTradesOnly, .out = &out};
+    }
+};
+
+
+// Engine counters, pulled with MatchingSystem::stats().
+struct MatchingStats {
+    uint64_t events = 0;
+    Histogram latency_ticks;        // ReadCycleCounter() ticks per event, output included.
+    Histogram fills_per_aggressor;  // Only orders that traded.
+    OrderBookStats book;
+
+    std::string ToString() const {
+        double ticks_per_nanosecond = CycleCounterTicksPerNanosecond();
+        auto nanoseconds = [&](double percentile) {
+            return latency_ticks.ValueAtPercentile(percentile) / ticks_per_nanosecond;
+        };
+        return absl::StrFormat(
+            "events=%u latency_ns(p50=%.0f p99=%.0f p99.9=%.0f max=%.0f) fills_per_aggressor(p50=%u p99=%u max=%u) "
+            "levels_swept=%u fills=%u iceberg_replenishments=%u self_trades_prevented=%u resting_orders=%u levels=%u/%u slabs=%u",
+            events, nanoseconds(50), nanoseconds(99), nanoseconds(99.9), latency_ticks.max() / ticks_per_nanosecond,
+            fills_per_aggressor.ValueAtPercentile(50), fills_per_aggressor.ValueAtPercentile(99), fills_per_aggressor.max(),
+            book.levels_swept, book.fills, book.iceberg_replenishments, book.self_trades_prevented, book.resting_orders, book.bid_levels, book.ask_levels,
+            book.allocated_slabs);
+    }
+};
+
+
+// Running totals of one participant's trades, kept by MatchingSystem when
+// participant tracking is on.
+struct ParticipantStats {
+    uint64_t bought = 0;
+    uint64_t sold = 0;
+    uint64_t bought_notional = 0;  // Sum of price * quantity.
+    uint64_t sold_notional = 0;
+    uint64_t self_trades_prevented = 0;
+
+    int64_t position() const {
+        return static_cast<int64_t>(bought) - static_cast<int64_t>(sold);
+    }
+
+    uint64_t volume() const {
+        return bought + sold;
+    }
+
+    bool operator==(const ParticipantStats&) const = default;
+};
+
+
+// What MatchingSystem::Preallocate sets aside at startup. Afterwards adding,
+// matching, modifying and cancelling orders within [min_price, max_price] do
+// not allocate, and orders that would exceed the limits are rejected instead.
+struct EngineCapacity {
+    size_t max_resting_orders = 1 << 20;
+    // Trades of one aggressor held for aggregation; beyond it they are
+    // reported in chunks.
+    size_t max_pending_trades = 1024;
+    // Changed price levels remembered for a market-data subscriber. Once this
+    // many are waiting, market data is published early, between records or in
+    // the middle of a sweep, so any event fits.
+    size_t max_touched_levels = 1024;
+    // Highest participant id accepted; ParticipantStats are reserved for all.
+    uint32_t max_participant = 0;
+    // Prices whose price-ladder pages are allocated up front, about 48 bytes
+    // per price and side; the whole domain takes 6.3MB. Outside the range a
+    // page is allocated when one of its prices is first used.
+    uint16_t min_price = 0;
+    uint16_t max_price = std::numeric_limits<uint16_t>::max();
+};
+
+
+// Outcome of one record passed to MatchingSystem::AddOrders.
+struct OrderResult {
+    enum class Status : uint8_t {
+        kAccepted,
+        kUnknownOrder,     // Cancel or modification of an order that is not resting.
+        kDuplicateId,      // New order reusing the id of a resting one.
+        kUnsupportedType,
+        kInvalidParticipant,  // Participant id above the MatchingSystem's limit.
+        // The remainder of a new order would have rested in a book holding
+        // EngineCapacity::max_resting_orders and was dropped; what traded
+        // before stays in filled_quantity.
+        kCapacityExceeded,
+    };
+
+    Status status = Status::kAccepted;
+    uint32_t filled_quantity = 0;   // Traded as a result of the record.
+    uint32_t resting_quantity = 0;  // Volume of the order left in the book afterwards.
+
+    bool accepted() const {
+        return status == Status::kAccepted;
+    }
+};
+
+
+class MatchingSystem {
+public:
+    // Participant ids index a dense array of ParticipantStats.
+    static constexpr uint32_t kMaxParticipant = (1 << 20) - 1;
+
+    explicit MatchingSystem(OutputPolicy output_policy = OutputPolicy::FullSnapshot(), TradeSink* trade_sink = nullptr)
+        : output_policy_(output_policy),
+          owned_trade_sink_(trade_sink ? nullptr : std::make_unique<CsvTradeWriter>(*output_policy_.out)),
+          trade_sink_(trade_sink ? trade_sink : owned_trade_sink_.get()),
+          trades_manager_(*trade_sink_, output_policy_.aggregate_trades) {
+        if (output_policy_.mode == OutputPolicy::Mode::kPeriodicSnapshot && output_policy_.interval == 0) {
+            LOG(FATAL) << "Snapshot interval must be positive";
+        }
+    }
+
+    ~MatchingSystem() {
+        Flush();
+    }
+
+    void Flush() {
+        trade_sink_->Flush();
+    }
+
+    // Dies on orders Apply() would reject for their id, participant or capacity.
+    void AddOrder(const LimitOrder& order, uint32_t participant = 0) {
+        if (participant > max_participant_) {
+            LOG(FATAL) << absl::StrFormat("Participant id %u is above %u", participant, max_participant_);
+        }
+        if (order_book_.Find(order.id())) {
+            LOG(FATAL) << absl::StrFormat("Adding order with id %u while an order with the same id is resting", order.id());
+        }
+        uint64_t start = ReadCycleCounter();
+        bool dropped = false;
+        SubmitOrder(order, participant, &dropped);
+        if (dropped) {
+            LOG(FATAL) << absl::StrFormat("Order %u does not fit a book of %u orders", order.id(), max_resting_orders_);
+        }
+        PublishBook();
+        RecordEvent(start);
+    }
+
+    bool CancelOrder(uint32_t id) {
+        uint64_t start = ReadCycleCounter();
+        bool cancelled = order_book_.Cancel(id);
+        if (cancelled) {
+            PublishBook();
+        }
+        RecordEvent(start);
+        return cancelled;
+    }
+
+    // Reducing the quantity at the same price keeps time priority. Any other change
+    // re-enters the order at the back of the queue and may match immediately.
+    bool ModifyOrder(uint32_t id, uint16_t new_price, uint32_t new_quantity) {
+        uint64_t start = ReadCycleCounter();
+        bool modified = Modify(id, new_price, new_quantity).has_value();
+        if (modified) {
+            PublishBook();
+        }
+        RecordEvent(start);
+        return modified;
+    }
+
+    const OrderBook& order_book() const {
+        return order_book_;
+    }
+
+    // Loads resting orders, in ForEachOrder() sequence, into an empty book
+    // without matching them. A market-data subscriber sees the levels as added.
+    // `participants` is either empty or holds the participant of each order.
+    void RestoreOrders(std::span<const LimitOrder> orders, std::span<const uint32_t> participants = {}) {
+        if (order_book_.size() != 0) {
+            LOG(FATAL) << absl::StrFormat("Restoring %u orders into a book with %u orders", orders.size(), order_book_.size());
+        }
+        if (!participants.empty() && participants.size() != orders.size()) {
+            LOG(FATAL) << absl::StrFormat("Restoring %u orders with %u participants", orders.size(), participants.size());
+        }
+        if (orders.size() > max_resting_orders_) {
+            LOG(FATAL) << absl::StrFormat("Restoring %u orders into a book of %u orders", orders.size(), max_resting_orders_);
+        }
+        order_book_.Reserve(orders.size());
+        for (size_t i = 0; i < orders.size(); ++i) {
+            order_book_.Add(orders[i], participants.empty() ? 0 : participants[i]);
+        }
+        order_book_.PublishMarketData();
+    }
+
+    // Applies to orders submitted afterwards; resting orders are unaffected.
+    void SetSelfTradePrevention(SelfTradePrevention mode) {
+        self_trade_prevention_ = mode;
+    }
+
+    SelfTradePrevention self_trade_prevention() const {
+        return self_trade_prevention_;
+    }
+
+    // Allocates everything `capacity` allows for and enforces its limits from
+    // now on.
+    void Preallocate(const EngineCapacity& capacity) {
+        if (capacity.max_participant > kMaxParticipant) {
+            LOG(FATAL) << absl::StrFormat("Participant id limit %u is above %u", capacity.max_participant, kMaxParticipant);
+        }
+        if (order_book_.size() > capacity.max_resting_orders) {
+            LOG(FATAL) << absl::StrFormat("The book already holds %u orders, more than %u", order_book_.size(), capacity.max_resting_orders);
+        }
+        if (capacity.min_price > capacity.max_price) {
+            LOG(FATAL) << absl::StrFormat("Price range %u-%u is empty", capacity.min_price, capacity.max_price);
+        }
+        max_resting_orders_ = capacity.max_resting_orders;
+        max_participant_ = capacity.max_participant;
+        order_book_.Reserve(max_resting_orders_ - order_book_.size());
+        order_book_.ReserveTouchedLevels(capacity.max_touched_levels);
+        order_book_.ReservePrices(capacity.min_price, capacity.max_price);
+        trades_manager_.Reserve(capacity.max_pending_trades);
+        participants_.reserve(size_t{max_participant_} + 1);
+    }
+
+    MemoryStats memory_stats() const {
+        MemoryStats stats;
+        order_book_.AddMemoryStats(stats);
+        stats.pending_trades = trades_manager_.memory_bytes();
+        stats.participants = participants_.capacity() * sizeof(ParticipantStats);
+        return stats;
+    }
+
+    // Starts keeping ParticipantStats for trades from now on. Checkpoints do
+    // not hold them, so they restart from zero on a restored engine.
+    void TrackParticipants() {
+        track_participants_ = true;
+    }
+
+    // Zero for participants that have not traded or when tracking is off.
+    ParticipantStats participant_stats(uint32_t participant) const {
+        return participant < participants_.size() ? participants_[participant] : ParticipantStats{};
+    }
+
+    // Market data is published after each event; nullptr stops it.
+    void SetMarketDataSubscriber(MarketDataSubscriber* subscriber) {
+        order_book_.set_market_data_subscriber(subscriber);
+    }
+
+    // Returns false for rejected records, such as cancels of unknown orders.
+    // The book is published after every record that changed it, including an
+    // order that traded before its remainder was dropped for capacity.
+    bool Apply(const OrderRecord& record) {
+        uint64_t start = ReadCycleCounter();
+        uint64_t level_changes = order_book_.level_changes();
+        bool accepted = Execute(record).accepted();
+        if (accepted || order_book_.level_changes() != level_changes) {
+            PublishBook();
+        }
+        RecordEvent(start);
+        return accepted;
+    }
+
+    // Applies a whole batch and writes one result per record. Trades are still
+    // reported per aggressor, but the trade sink is flushed, market data is
+    // published and snapshots are written once, after the last record. Market
+    // data also goes out early once EngineCapacity::max_touched_levels changed
+    // levels are waiting.
+    void AddOrders(std::span<const OrderRecord> records, std::span<OrderResult> results) {
+        if (results.size() < records.size()) {
+            LOG(FATAL) << absl::StrFormat("%u results do not fit %u records", results.size(), records.size());
+        }
+        uint64_t start = ReadCycleCounter();
+        for (size_t i = 0; i < records.size(); ++i) {
+            results[i] = Execute(records[i]);
+            uint64_t finish = ReadCycleCounter();
+            latency_ticks_.Record(finish - start);
+            start = finish;
+        }
+        if (!records.empty()) {
+            trade_sink_->Flush();
+            PublishBook(static_cast<uint32_t>(records.size()));
+            CountEvents(records.size());
+        }
+    }
+
+    std::vector<OrderResult> AddOrders(std::span<const OrderRecord> records) {
+        std::vector<OrderResult> results(records.size());
+        AddOrders(records, results);
+        return results;
+    }
+
+    MatchingStats stats() const {
+        MatchingStats stats{
+            .events = events_,
+            .latency_ticks = latency_ticks_,
+            .fills_per_aggressor = fills_per_aggressor_,
+            .book = order_book_.stats(),
+        };
+        return stats;
+    }
+
+private:
+    // Applies a record without publishing anything.
+    OrderResult Execute(const OrderRecord& record) {
+        OrderResult result;
+        switch (record.action) {
+            case OrderAction::kAdd: {
+                if (!OrderType_IsValid(record.type)) {
+                    result.status = OrderResult::Status::kUnsupportedType;
+                    return result;
+                }
+                if (record.participant > max_participant_) {
+                    result.status = OrderResult::Status::kInvalidParticipant;
+                    return result;
+                }
+                if (order_book_.Find(record.id)) {
+                    result.status = OrderResult::Status::kDuplicateId;
+                    return result;
+                }
+                bool dropped = false;
+                if (record.type == ICEBERG_ORDER) {
+                    result.filled_quantity = SubmitOrder(IcebergOrder(record.side, record.id, record.price, record.quantity, record.peak_size, record.symbol), record.participant, &dropped);
+                } else if (record.type == LIMIT_ORDER) {
+                    result.filled_quantity = SubmitOrder(LimitOrder(record.side, record.id, record.price, record.quantity, record.symbol), record.participant, &dropped);
+                } else {
+                    result.filled_quantity = SubmitOrder(ImmediateOrder(record.type, record.side, record.id, record.price, record.quantity, record.symbol), record.participant);
+                }
+                if (dropped) {
+                    result.status = OrderResult::Status::kCapacityExceeded;
+                    return result;
+                }
+                break;
+            }
+            case OrderAction::kCancel:
+                if (!order_book_.Cancel(record.id)) {
+                    result.status = OrderResult::Status::kUnknownOrder;
+                }
+                return result;
+            case OrderAction::kModify: {
+                std::optional<uint32_t> filled = Modify(record.id, record.price, record.quantity);
+                if (!filled) {
+                    result.status = OrderResult::Status::kUnknownOrder;
+                    return result;
+                }
+                result.filled_quantity = *filled;
+                break;
+            }
+        }
+        if (const LimitOrder* order = order_book_.Find(record.id)) {
+            result.resting_quantity = OrderBook::RemainingVolume(*order);
+        }
+        return result;
+    }
+
+    // Returns the traded quantity, or nullopt if the order is not resting. The
+    // replacement keeps the participant of the order.
+    std::optional<uint32_t> Modify(uint32_t id, uint16_t new_price, uint32_t new_quantity) {
+        const LimitOrder* order = order_book_.Find(id);
+        if (!order) {
+            return std::nullopt;
+        }
+        if (new_quantity == 0) {
+            order_book_.Cancel(id);
+            return 0;
+        }
+        if (order->price() == new_price && new_quantity <= OrderBook::RemainingVolume(*order)) {
+            order_book_.Reduce(id, new_quantity);
+            return 0;
+        }
+        LimitOrder replacement = order->type() == ICEBERG_ORDER
+            ? IcebergOrder(order->side(), id, new_price, new_quantity, order->peak_size(), order->symbol())
+            : LimitOrder(order->side(), id, new_price, new_quantity, order->symbol());
+        uint32_t participant = order_book_.Participant(id);
+        order_book_.Cancel(id);
+        return SubmitOrder(replacement, participant);
+    }
+
+    void RecordEvent(uint64_t start) {
+        latency_ticks_.Record(ReadCycleCounter() - start);
+        CountEvents(1);
+    }
+
+    void CountEvents(uint64_t events) {
+        uint64_t interval = output_policy_.stats_interval;
+        if (interval && (events_ + events) / interval != events_ / interval) {
+            events_ += events;
+            *output_policy_.stats_out << stats().ToString() << '\n';
+        } else {
+            events_ += events;
+        }
+    }
+
+    // Publishes the state after `events` events.
+    void PublishBook(uint32_t events = 1) {
+        order_book_.PublishMarketData();
+        if (output_policy_.mode != OutputPolicy::Mode::kTradesOnly) {
+            trade_sink_->Flush();
+        }
+        switch (output_policy_.mode) {
+            case OutputPolicy::Mode::kFullSnapshot:
+                WriteBook(PriceLevelBitmap::kLevels);
+                break;
+            case OutputPolicy::Mode::kTopLevels:
+                WriteBook(output_policy_.depth);
+                break;
+            case OutputPolicy::Mode::kPeriodicSnapshot:
+                events_since_snapshot_ += events;
+                if (events_since_snapshot_ >= output_policy_.interval) {
+                    events_since_snapshot_ %= output_policy_.interval;
+                    WriteBook(PriceLevelBitmap::kLevels);
+                }
+                break;
+            case OutputPolicy::Mode::kTradesOnly:
+                break;
+        }
+    }
+
+    // Prints the book table like OrderBook::ToString, reusing the buffers of
+    // the previous call.
+    void WriteBook(size_t max_levels) {
+        order_book_.CaptureSnapshot(book_view_, max_levels);
+        book_text_.clear();
+        RenderTable(book_view_, book_text_);
+        output_policy_.out->write(book_text_.data(), static_cast<std::streamsize>(book_text_.size()));
+    }
+
+    // Picks the sweep instantiation for the self-trade prevention mode, so the
+    // match loop only tests participants when a mode is on.
+    uint32_t SubmitOrder(const LimitOrder& order, uint32_t participant, bool* dropped = nullptr) {
+        switch (self_trade_prevention_) {
+            case SelfTradePrevention::kNone:
+                return SubmitOrder<SelfTradePrevention::kNone>(order, participant, dropped);
+            case SelfTradePrevention::kCancelNewest:
+                return SubmitOrder<SelfTradePrevention::kCancelNewest>(order, participant, dropped);
+            case SelfTradePrevention::kCancelOldest:
+                return SubmitOrder<SelfTradePrevention::kCancelOldest>(order, participant, dropped);
+            case SelfTradePrevention::kDecrementBoth:
+                break;
+        }
+        return SubmitOrder<SelfTradePrevention::kDecrementBoth>(order, participant, dropped);
+    }
+
+    // All order types take the same path: the whole remaining volume trades,
+    // then limit orders and icebergs rest with at most their peak size visible
+    // and the other types are dropped. A fill-or-kill order that cannot fill
+    // completely is dropped before it touches the book. Without self-trade
+    // prevention its own resting orders count towards the fill; with it, a
+    // fill that would need them is killed. A remainder that would rest in a
+    // book already holding max_resting_orders_ is dropped instead and
+    // `dropped` set. Returns the traded quantity.
+    template <SelfTradePrevention kStp>
+    uint32_t SubmitOrder(LimitOrder order, uint32_t participant, bool* dropped) {
+        if (!OrderType_IsValid(order.type())) {
+            LOG(FATAL) << absl::StrFormat("Error during AddOrder, type of order is not supported %d", order.type());
+        }
+        if (order.type() == FOK_ORDER) {
+            bool can_fill = false;
+            if constexpr (kStp == SelfTradePrevention::kNone) {
+                can_fill = order_book_.CanFill(order);
+            } else {
+                can_fill = order_book_.CanFillWithoutSelfTrade<kStp>(order, participant);
+            }
+            if (!can_fill) {
+                return 0;
+            }
+        }
+        uint32_t volume = order.hidden_full_volume();
+        order.mutable_quantity() = volume;
+
+        auto trade = [this, &order](const LimitOrder& opposite_order, uint32_t quantity, uint32_t& pending_trade) {
+            uint32_t price = LimitOrder::CalculatePrice(order, opposite_order);
+            trades_manager_.Append(order.symbol(), order.id(), opposite_order.id(), order.side(), price, quantity, pending_trade);
+            return price;
+        };
+        SweepStats sweep;
+        if (kStp == SelfTradePrevention::kNone && !track_participants_) {
+            sweep = order_book_.Sweep(order, trade);
+        } else {
+            sweep = order_book_.Sweep<kStp>(order, participant, [&](const LimitOrder& opposite_order, uint32_t quantity, uint32_t& pending_trade, uint32_t opposite_participant) {
+                uint32_t price = trade(opposite_order, quantity, pending_trade);
+                if (track_participants_) {
+                    uint64_t notional = uint64_t{price} * quantity;
+                    ParticipantStats& buyer = Participant(order.side() == BUY_OS ? participant : opposite_participant);
+                    buyer.bought += quantity;
+                    buyer.bought_notional += notional;
+                    ParticipantStats& seller = Participant(order.side() == BUY_OS ? opposite_participant : participant);
+                    seller.sold += quantity;
+                    seller.sold_notional += notional;
+                }
+            });
+            if (sweep.self_trades_prevented && track_participants_) {
+                Participant(participant).self_trades_prevented += sweep.self_trades_prevented;
+            }
+        }
+        if (sweep.fills) {
+            fills_per_aggressor_.Record(sweep.fills);
+        }
+
+        order.mutable_quantity() = std::min(order.peak_size(), order.hidden_full_volume());
+        trades_manager_.NotifyAll();
+        if (order.rests() && !sweep.aggressor_cancelled && order.quantity()) {
+            if (order_book_.size() < max_resting_orders_) {
+                order_book_.Add(order, participant);
+            } else if (dropped) {
+                *dropped = true;
+            }
+        }
+        return volume - order.hidden_full_volume() - sweep.decremented_quantity;
+    }
+
+    ParticipantStats& Participant(uint32_t participant) {
+        if (participant >= participants_.size()) {
+            participants_.resize(participant + 1);
+        }
+        return participants_[participant];
     }
 
     OrderBook order_book_;
+    OutputPolicy output_policy_;
+    std::unique_ptr<TradeSink> owned_trade_sink_;
+    TradeSink* trade_sink_;
     TradeManager trades_manager_;
+    uint32_t events_since_snapshot_ = 0;
+    uint64_t events_ = 0;
+    Histogram latency_ticks_;
+    Histogram fills_per_aggressor_;
+    SelfTradePrevention self_trade_prevention_ = SelfTradePrevention::kNone;
+    bool track_participants_ = false;
+    std::vector<ParticipantStats> participants_;
+    size_t max_resting_orders_ = std::numeric_limits<size_t>::max();
+    uint32_t max_participant_ = kMaxParticipant;
+    BookSnapshot book_view_;
+    std::string book_text_;
 };
 
 
@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "batch_parser.h"
+#include "homework.h"
+#include "order_flow_generator.h"
+#include "order_pipeline.h"
+
+namespace {
+
+constexpr size_t kFlowSize = 1 << 20;
+constexpr size_t kWarmupOrders = 1 << 16;
+constexpr size_t kLatencySamples = 1 << 16;
+
+class NullTradeSink : public TradeSink {
+public:
+    void OnTrade(const Trade& trade) override {
+        benchmark::DoNotOptimize(trade);
+    }
+};
+
+OrderFlowConfig FlowConfig(const benchmark::State& state) {
+    OrderFlowConfig config;
+    config.aggressive_ratio = state.range(0) / 100.0;
+    config.iceberg_ratio = state.range(1) / 100.0;
+    config.book_depth = static_cast<uint16_t>(state.range(2));
+    config.price_model = static_cast<OrderFlowConfig::PriceModel>(state.range(3));
+    config.cancel_ratio = state.range(4) / 100.0;
+    return config;
+}
+
+void ReportLatencies(benchmark::State& state, std::vector<uint32_t>& latencies_ns) {
+    if (latencies_ns.empty()) {
+        return;
+    }
+    auto percentile = [&latencies_ns](double fraction) {
+        auto it = latencies_ns.begin() + static_cast<size_t>(fraction * (latencies_ns.size() - 1));
+        std::nth_element(latencies_ns.begin(), it, latencies_ns.end());
+        return static_cast<double>(*it);
+    };
+    state.counters["p50_ns"] = percentile(0.5);
+    state.counters["p99_ns"] = percentile(0.99);
+    state.counters["p99.9_ns"] = percentile(0.999);
+}
+
+// Args: aggressive %, iceberg %, book depth, OrderFlowConfig::PriceModel, cancel %.
+// The timed loop applies an endless flow, refilled from the generator so ids
+// never repeat; per-order latencies come from a separate pass over a fresh
+// engine, so the throughput carries no timer calls.
+void BM_MatchingSystem_AddOrder(benchmark::State& state) {
+    OrderFlowGenerator generator(FlowConfig(state));
+    std::vector<OrderRecord> warmup = generator.Generate(kWarmupOrders);
+    std::vector<OrderRecord> flow = generator.Generate(kFlowSize);
+
+    NullTradeSink sink;
+    MatchingSystem system(OutputPolicy::TradesOnly(), &sink);
+    for (const OrderRecord& record : warmup) {
+        system.Apply(record);
+    }
+
+    size_t next = 0;
+    for (auto _ : state) {
+        system.Apply(flow[next]);
+        if (++next == flow.size()) {
+            state.PauseTiming();
+            generator.Generate(flow);
+            next = 0;
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["orders/s"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+    state.counters["resting"] = static_cast<double>(system.order_book().size());
+
+    OrderFlowGenerator latency_generator(FlowConfig(state));
+    MatchingSystem latency_system(OutputPolicy::TradesOnly(), &sink);
+    for (const OrderRecord& record : latency_generator.Generate(kWarmupOrders)) {
+        latency_system.Apply(record);
+    }
+    std::vector<uint32_t> latencies_ns;
+    latencies_ns.reserve(kLatencySamples);
+    for (const OrderRecord& record : latency_generator.Generate(kLatencySamples)) {
+        auto start = std::chrono::steady_clock::now();
+        latency_system.Apply(record);
+        auto finish = std::chrono::steady_clock::now();
+        latencies_ns.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count()));
+    }
+    ReportLatencies(state, latencies_ns);
+}
+BENCHMARK(BM_MatchingSystem_AddOrder)
+    ->ArgNames({"aggressive%", "iceberg%", "depth", "model", "cancel%"})
+    ->Args({0, 0, 50, 1, 0})
+    ->Args({20, 0, 50, 1, 0})
+    ->Args({20, 20, 50, 1, 0})
+    ->Args({50, 20, 50, 1, 0})
+    ->Args({20, 10, 10, 0, 0})
+    ->Args({20, 10, 1000, 0, 0})
+    ->Args({20, 10, 200, 2, 0})
+    ->Args({10, 10, 50, 1, 45});
+
+// Rests `state.range(0)` orders per level on `state.range(1)` levels, then pops them all.
+void BM_OrderBook_AddPopOpposite(benchmark::State& state) {
+    uint32_t orders_per_level = static_cast<uint32_t>(state.range(0));
+    uint16_t levels = static_cast<uint16_t>(state.range(1));
+    OrderBook order_book;
+    for (auto _ : state) {
+        uint32_t id = 0;
+        for (uint16_t level = 0; level < levels; ++level) {
+            for (uint32_t i = 0; i < orders_per_level; ++i) {
+                order_book.Add(LimitOrder(SELL_OS, id++, 1000 + level, 100));
+            }
+        }
+        while (order_book.GetOpposite(BUY_OS)) {
+            order_book.PopOpposite(BUY_OS);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * orders_per_level * levels);
+}
+BENCHMARK(BM_OrderBook_AddPopOpposite)->Args({1, 1000})->Args({100, 10})->Args({10, 1000});
+
+// Rests `state.range(0)` orders per level on `state.range(1)` levels, then clears
+// them all with one aggressive order.
+void BM_MatchingSystem_Sweep(benchmark::State& state) {
+    uint32_t orders_per_level = static_cast<uint32_t>(state.range(0));
+    uint16_t levels = static_cast<uint16_t>(state.range(1));
+    NullTradeSink sink;
+    MatchingSystem system(OutputPolicy::TradesOnly(), &sink);
+    uint32_t id = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (uint16_t level = 0; level < levels; ++level) {
+            for (uint32_t i = 0; i < orders_per_level; ++i) {
+                system.AddOrder(LimitOrder(SELL_OS, id++, 1000 + level, 100));
+            }
+        }
+        state.ResumeTiming();
+        system.AddOrder(LimitOrder(BUY_OS, id++, 1000 + levels, orders_per_level * levels * 100));
+    }
+    state.SetItemsProcessed(state.iterations() * orders_per_level * levels);
+}
+BENCHMARK(BM_MatchingSystem_Sweep)->Args({1, 1000})->Args({100, 10})->Args({10, 1000});
+
+// Pre-trade risk queries against a book built from a flow with `state.range(0)` levels per side.
+void BM_OrderBook_DepthQueries(benchmark::State& state) {
+    OrderFlowConfig config;
+    config.iceberg_ratio = 0.2;
+    config.book_depth = static_cast<uint16_t>(state.range(0));
+    NullTradeSink sink;
+    MatchingSystem system(OutputPolicy::TradesOnly(), &sink);
+    for (const OrderRecord& record : OrderFlowGenerator(config).Generate(kWarmupOrders)) {
+        system.Apply(record);
+    }
+    const OrderBook& book = system.order_book();
+    uint64_t quantity = 1;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(book.EstimateFill(BUY_OS, quantity));
+        benchmark::DoNotOptimize(book.VolumeWithin(BUY_OS, 10));
+        quantity = quantity * 7 % 100000 + 1;
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_OrderBook_DepthQueries)->Arg(50)->Arg(1000);
+
+// Book views of the `state.range(0)` best levels per side, from a flow with
+// 1000 levels per side: what the matching thread pays to capture the levels
+// for a depth view, and the full table rendered synchronously.
+void BM_OrderBook_Views(benchmark::State& state) {
+    OrderFlowConfig config;
+    config.iceberg_ratio = 0.2;
+    config.book_depth = 1000;
+    NullTradeSink sink;
+    MatchingSystem system(OutputPolicy::TradesOnly(), &sink);
+    for (const OrderRecord& record : OrderFlowGenerator(config).Generate(kWarmupOrders)) {
+        system.Apply(record);
+    }
+    const OrderBook& book = system.order_book();
+    size_t levels = static_cast<size_t>(state.range(0));
+    BookSnapshot snapshot;
+    std::string text;
+    for (auto _ : state) {
+        book.CaptureSnapshot(snapshot, levels, state.range(1) != 0);
+        if (state.range(1)) {
+            text.clear();
+            RenderTable(snapshot, text);
+            benchmark::DoNotOptimize(text.data());
+        }
+        benchmark::DoNotOptimize(snapshot.buys.levels.data());
+    }
+}
+BENCHMARK(BM_OrderBook_Views)->Args({10, 0})->Args({10, 1})->Args({1000, 0})->Args({1000, 1});
+
+std::string FlowText(size_t count) {
+    OrderFlowConfig config;
+    config.iceberg_ratio = 0.2;
+    OrderFlowGenerator generator(config);
+    std::string text;
+    for (const OrderRecord& record : generator.Generate(count)) {
+        text += record.side == BUY_OS ? "B," : "S,";
+        text += std::to_string(record.id) + "," + std::to_string(record.price) + "," + std::to_string(record.quantity);
+        if (record.type == ICEBERG_ORDER) {
+            text += "," + std::to_string(record.peak_size);
+        }
+        text += '\n';
+    }
+    return text;
+}
+
+void BM_OrderParser_Parse(benchmark::State& state) {
+    std::string text = FlowText(4096);
+    std::vector<std::string> lines = absl::StrSplit(text, '\n', absl::SkipEmpty());
+    size_t next = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(OrderParser::Parse(lines[next]));
+        if (++next == lines.size()) {
+            next = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OrderParser_Parse);
+
+void BM_BatchOrderParser_Next(benchmark::State& state) {
+    std::string text = FlowText(1 << 16);
+    std::vector<OrderRecord> batch(4096);
+    size_t records = 0;
+    for (auto _ : state) {
+        BatchOrderParser parser(text);
+        while (size_t count = parser.Next(batch)) {
+            records += count;
+        }
+        benchmark::DoNotOptimize(batch.data());
+    }
+    state.SetItemsProcessed(records);
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_BatchOrderParser_Next);
+
+// Drops everything written to it, so only formatting is measured.
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override {
+        return c;
+    }
+
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+        return count;
+    }
+};
+
+// Text in, trades out: on the calling thread (0) or through OrderPipeline (1).
+void BM_EndToEnd(benchmark::State& state) {
+    std::string text = FlowText(1 << 18);
+    NullBuffer null_buffer;
+    std::ostream out(&null_buffer);
+    for (auto _ : state) {
+        if (state.range(0)) {
+            OrderPipeline pipeline;
+            benchmark::DoNotOptimize(pipeline.Run(text, out));
+        } else {
+            MatchingSystem system(OutputPolicy::TradesOnly(out));
+            BatchOrderParser parser(text);
+            std::vector<OrderRecord> batch(4096);
+            std::vector<OrderResult> results(batch.size());
+            while (size_t count = parser.Next(batch)) {
+                system.AddOrders(std::span<const OrderRecord>(batch.data(), count), results);
+            }
+            system.Flush();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * (1 << 18));
+}
+BENCHMARK(BM_EndToEnd)->Arg(0)->Arg(1)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -1,89 +1,125 @@
 #include <gtest/gtest.h>
 #include "homework.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <map>
 #include <memory>
+#include <new>
+#include <random>
 #include <sstream>
 #include <streambuf>
 
+// Counts heap allocations, so tests can check that a code path makes none.
+std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+// Not inlined, so the compiler does not see free() called on the result of new.
+[[gnu::noinline]] void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+uint32_t RestingQuantity(const MatchingSystem& system, uint32_t id) {
+    const LimitOrder* order = system.order_book().Find(id);
+    return order ? order->quantity() : 0;
+}
+
+uint32_t RestingHiddenVolume(const MatchingSystem& system, uint32_t id) {
+    const LimitOrder* order = system.order_book().Find(id);
+    return order ? order->hidden_full_volume() : 0;
+}
+
 TEST(AggresiveTest, Entrance1) {
-    auto order1 = std::make_shared<LimitOrder>(OrderSide::BUY_OS, 0, 99, 50000);
-    auto order2 = std::make_shared<LimitOrder>(OrderSide::BUY_OS, 1, 98, 25500);
-    auto order3 = std::make_shared<LimitOrder>(OrderSide::SELL_OS, 2, 100, 10000);
-    auto order4 = std::make_shared<LimitOrder>(OrderSide::SELL_OS, 3, 100, 7500);
-    auto order5 = std::make_shared<LimitOrder>(OrderSide::SELL_OS, 4, 101, 20000);
+    LimitOrder order1(OrderSide::BUY_OS, 0, 99, 50000);
+    LimitOrder order2(OrderSide::BUY_OS, 1, 98, 25500);
+    LimitOrder order3(OrderSide::SELL_OS, 2, 100, 10000);
+    LimitOrder order4(OrderSide::SELL_OS, 3, 100, 7500);
+    LimitOrder order5(OrderSide::SELL_OS, 4, 101, 20000);
 
     MatchingSystem system;
     for (auto order : {order1, order2, order3, order4, order5}) {
         system.AddOrder(order);
     }
     
-    auto iceberg_order = std::make_shared<IcebergOrder>(OrderSide::BUY_OS, 5, 100, 100000, 10000);
+    IcebergOrder iceberg_order(OrderSide::BUY_OS, 5, 100, 100000, 10000);
     system.AddOrder(iceberg_order);
 
-    EXPECT_EQ(iceberg_order->quantity(), 10000);
-    EXPECT_EQ(iceberg_order->hidden_full_volume(), 82500);
-    EXPECT_EQ(order1->quantity(), 50000);
-    EXPECT_EQ(order2->quantity(), 25500);
-    EXPECT_EQ(order3->quantity(), 0);
-    EXPECT_EQ(order4->quantity(), 0);
-    EXPECT_EQ(order5->quantity(), 20000);
+    EXPECT_EQ(RestingQuantity(system, 5), 10000);
+    EXPECT_EQ(RestingHiddenVolume(system, 5), 82500);
+    EXPECT_EQ(RestingQuantity(system, 0), 50000);
+    EXPECT_EQ(RestingQuantity(system, 1), 25500);
+    EXPECT_EQ(RestingQuantity(system, 2), 0);
+    EXPECT_EQ(RestingQuantity(system, 3), 0);
+    EXPECT_EQ(RestingQuantity(system, 4), 20000);
 }
 
 TEST(PassiveTest, Test1) {
-    auto order1 = std::make_shared<LimitOrder>(OrderSide::BUY_OS, 0, 99, 50000);
-    auto order2 = std::make_shared<LimitOrder>(OrderSide::BUY_OS, 1, 98, 25500);
-    auto order3 = std::make_shared<LimitOrder>(OrderSide::SELL_OS, 2, 100, 10000);
-    auto order4 = std::make_shared<LimitOrder>(OrderSide::SELL_OS, 3, 100, 7500);
-    auto order5 = std::make_shared<LimitOrder>(OrderSide::SELL_OS, 4, 101, 20000);
+    LimitOrder order1(OrderSide::BUY_OS, 0, 99, 50000);
+    LimitOrder order2(OrderSide::BUY_OS, 1, 98, 25500);
+    LimitOrder order3(OrderSide::SELL_OS, 2, 100, 10000);
+    LimitOrder order4(OrderSide::SELL_OS, 3, 100, 7500);
+    LimitOrder order5(OrderSide::SELL_OS, 4, 101, 20000);
 
     MatchingSystem system;
     for (auto order : {order1, order2, order3, order4, order5}) {
         system.AddOrder(order);
     }
     
-    auto iceberg_order = std::make_shared<IcebergOrder>(OrderSide::BUY_OS, 5, 100, 100000, 10000);
+    IcebergOrder iceberg_order(OrderSide::BUY_OS, 5, 100, 100000, 10000);
     system.AddOrder(iceberg_order);
     
 
-    auto order6 = std::make_shared<LimitOrder>(OrderSide::SELL_OS, 6, 99, 10000);
+    LimitOrder order6(OrderSide::SELL_OS, 6, 99, 10000);
 
     system.AddOrder(order6);
 
-    EXPECT_EQ(iceberg_order->quantity(), 10000);
-    EXPECT_EQ(iceberg_order->hidden_full_volume(), 72500);
-    EXPECT_EQ(order1->quantity(), 50000);
-    EXPECT_EQ(order2->quantity(), 25500);
-    EXPECT_EQ(order3->quantity(), 0);
-    EXPECT_EQ(order4->quantity(), 0);
-    EXPECT_EQ(order5->quantity(), 20000);
-    EXPECT_EQ(order6->quantity(), 0);
+    EXPECT_EQ(RestingQuantity(system, 5), 10000);
+    EXPECT_EQ(RestingHiddenVolume(system, 5), 72500);
+    EXPECT_EQ(RestingQuantity(system, 0), 50000);
+    EXPECT_EQ(RestingQuantity(system, 1), 25500);
+    EXPECT_EQ(RestingQuantity(system, 2), 0);
+    EXPECT_EQ(RestingQuantity(system, 3), 0);
+    EXPECT_EQ(RestingQuantity(system, 4), 20000);
+    EXPECT_EQ(RestingQuantity(system, 6), 0);
 
-    auto order7= std::make_shared<LimitOrder>(OrderSide::SELL_OS, 7, 98, 11000);
+    LimitOrder order7(OrderSide::SELL_OS, 7, 98, 11000);
     system.AddOrder(order7);
-    EXPECT_EQ(iceberg_order->quantity(), 9000);
-    EXPECT_EQ(iceberg_order->hidden_full_volume(), 61500);
-    EXPECT_EQ(order7->quantity(), 0);
+    EXPECT_EQ(RestingQuantity(system, 5), 9000);
+    EXPECT_EQ(RestingHiddenVolume(system, 5), 61500);
+    EXPECT_EQ(RestingQuantity(system, 7), 0);
 
-    auto another_iceberg_order = std::make_shared<IcebergOrder>(OrderSide::BUY_OS, 8, 100, 50000, 20000);
+    IcebergOrder another_iceberg_order(OrderSide::BUY_OS, 8, 100, 50000, 20000);
     system.AddOrder(another_iceberg_order);
 
-    auto order8= std::make_shared<LimitOrder>(OrderSide::SELL_OS, 9, 98, 35000);
+    LimitOrder order8(OrderSide::SELL_OS, 9, 98, 35000);
 
     system.AddOrder(order8);
 
-    EXPECT_EQ(order8->quantity(), 0);
-    EXPECT_EQ(iceberg_order->quantity(), 4000);
-    EXPECT_EQ(iceberg_order->hidden_full_volume(), 46500);
-    EXPECT_EQ(another_iceberg_order->quantity(), 20000);
-    EXPECT_EQ(another_iceberg_order->hidden_full_volume(), 30000);
+    EXPECT_EQ(RestingQuantity(system, 9), 0);
+    EXPECT_EQ(RestingQuantity(system, 5), 4000);
+    EXPECT_EQ(RestingHiddenVolume(system, 5), 46500);
+    EXPECT_EQ(RestingQuantity(system, 8), 20000);
+    EXPECT_EQ(RestingHiddenVolume(system, 8), 30000);
 }
 
 TEST(FormattingTest, OrderBookTest) {
 
-    auto order1 = std::make_shared<LimitOrder>(OrderSide::BUY_OS, 1234567890, 32503, 1234567890);
-    auto order2 = std::make_shared<LimitOrder>(OrderSide::BUY_OS, 1138, 31502, 7500);
-    auto order3 = std::make_shared<LimitOrder>(OrderSide::SELL_OS, 1234567891, 32504, 1234567890);
-    auto order4 = std::make_shared<LimitOrder>(OrderSide::SELL_OS, 6808, 32505, 7777);
-    auto order5 = std::make_shared<LimitOrder>(OrderSide::SELL_OS, 42100, 32507, 3000);
+    LimitOrder order1(OrderSide::BUY_OS, 1234567890, 32503, 1234567890);
+    LimitOrder order2(OrderSide::BUY_OS, 1138, 31502, 7500);
+    LimitOrder order3(OrderSide::SELL_OS, 1234567891, 32504, 1234567890);
+    LimitOrder order4(OrderSide::SELL_OS, 6808, 32505, 7777);
+    LimitOrder order5(OrderSide::SELL_OS, 42100, 32507, 3000);
 
     OrderBook order_book;
     for (auto order : {order1, order2, order3, order4, order5}) {
@@ -132,7 +168,8 @@ TEST(FormattingTest, IcebergOrderTest) {
     line = "S,100345,5103,100000,10000";
     auto order_or_status = OrderParser::Parse(line);
     EXPECT_NE(order_or_status, std::nullopt);
-    std::shared_ptr<IcebergOrder> iceberg_order(static_cast<IcebergOrder*>(order_or_status.value().release()));
+    std::shared_ptr<LimitOrder> iceberg_order(order_or_status.value().release());
+    EXPECT_EQ(iceberg_order->type(), ICEBERG_ORDER);
     EXPECT_EQ(iceberg_order->side(), SELL_OS);
     EXPECT_EQ(iceberg_order->id(), 100345);
     EXPECT_EQ(iceberg_order->price(), 5103);
@@ -140,6 +177,869 @@ TEST(FormattingTest, IcebergOrderTest) {
     EXPECT_EQ(iceberg_order->peak_size(), 10000);
 }
 
+TEST(OrderBookTest, PriceLevelBitmap) {
+    PriceLevelBitmap bitmap;
+    EXPECT_EQ(bitmap.NextAbove(0), std::nullopt);
+    EXPECT_EQ(bitmap.NextBelow(65535), std::nullopt);
+
+    for (uint16_t price : {0, 63, 64, 4095, 4096, 65535}) {
+        bitmap.Set(price);
+    }
+    EXPECT_EQ(bitmap.NextAbove(0), 63);
+    EXPECT_EQ(bitmap.NextAbove(63), 64);
+    EXPECT_EQ(bitmap.NextAbove(64), 4095);
+    EXPECT_EQ(bitmap.NextAbove(4096), 65535);
+    EXPECT_EQ(bitmap.NextAbove(65535), std::nullopt);
+    EXPECT_EQ(bitmap.NextBelow(65535), 4096);
+    EXPECT_EQ(bitmap.NextBelow(4095), 64);
+    EXPECT_EQ(bitmap.NextBelow(63), 0);
+    EXPECT_EQ(bitmap.NextBelow(0), std::nullopt);
+
+    bitmap.Reset(64);
+    bitmap.Reset(4095);
+    EXPECT_EQ(bitmap.NextAbove(63), 4096);
+    EXPECT_EQ(bitmap.NextBelow(4096), 63);
+
+    // Prices in chunks that were never set read as empty.
+    size_t memory = bitmap.memory_bytes();
+    bitmap.Reset(30000);
+    EXPECT_FALSE(bitmap.Test(30000));
+    EXPECT_EQ(bitmap.NextAbove(29000), 65535);
+    EXPECT_EQ(bitmap.memory_bytes(), memory);
+}
+
+TEST(OrderBookTest, BestLevelAfterPop) {
+    OrderBook order_book;
+    order_book.Add(LimitOrder(OrderSide::SELL_OS, 0, 65000, 10));
+    order_book.Add(LimitOrder(OrderSide::SELL_OS, 1, 3, 10));
+    order_book.Add(LimitOrder(OrderSide::SELL_OS, 2, 3, 10));
+    order_book.Add(LimitOrder(OrderSide::BUY_OS, 3, 1, 10));
+    order_book.Add(LimitOrder(OrderSide::BUY_OS, 4, 2, 10));
+
+    EXPECT_EQ(order_book.GetOpposite(BUY_OS)->id(), 1);
+    order_book.PopOpposite(BUY_OS);
+    EXPECT_EQ(order_book.GetOpposite(BUY_OS)->id(), 2);
+    order_book.PopOpposite(BUY_OS);
+    EXPECT_EQ(order_book.GetOpposite(BUY_OS)->id(), 0);
+    order_book.PopOpposite(BUY_OS);
+    EXPECT_EQ(order_book.GetOpposite(BUY_OS), nullptr);
+
+    EXPECT_EQ(order_book.GetOpposite(SELL_OS)->id(), 4);
+    order_book.PopOpposite(SELL_OS);
+    EXPECT_EQ(order_book.GetOpposite(SELL_OS)->id(), 3);
+    order_book.PopOpposite(SELL_OS);
+    EXPECT_EQ(order_book.GetOpposite(SELL_OS), nullptr);
+}
+
+TEST(OrderBookTest, PoolRecyclesSlots) {
+    OrderBook order_book;
+    for (uint32_t round = 0; round < 3; ++round) {
+        for (uint32_t id = 0; id < 100; ++id) {
+            order_book.Add(LimitOrder(OrderSide::SELL_OS, id, 100 + id % 7, 10));
+        }
+        EXPECT_EQ(order_book.size(), 100);
+        while (order_book.GetOpposite(BUY_OS)) {
+            order_book.PopOpposite(BUY_OS);
+        }
+        EXPECT_EQ(order_book.size(), 0);
+    }
+    EXPECT_EQ(order_book.Find(0), nullptr);
+}
+
+TEST(OrderBookTest, SweepConsumesLevels) {
+    OrderBook order_book;
+    order_book.Add(LimitOrder(OrderSide::SELL_OS, 0, 100, 10));
+    order_book.Add(LimitOrder(OrderSide::SELL_OS, 2, 100, 5));
+    order_book.Add(LimitOrder(OrderSide::SELL_OS, 3, 101, 7));
+    order_book.Add(LimitOrder(OrderSide::SELL_OS, 4, 103, 1));
+    // Rests an iceberg with 4 of its 9 showing behind order 2.
+    LimitOrder iceberg = IcebergOrder(OrderSide::SELL_OS, 5, 100, 9, 4);
+    iceberg.mutable_quantity() = 4;
+    order_book.Add(iceberg);
+
+    LimitOrder buy(OrderSide::BUY_OS, 6, 102, 30);
+    std::vector<std::pair<uint32_t, uint32_t>> fills;
+    order_book.Sweep(buy, [&fills](const LimitOrder& resting, uint32_t quantity, uint32_t&) {
+        fills.emplace_back(resting.id(), quantity);
+    });
+    EXPECT_EQ(fills, (std::vector<std::pair<uint32_t, uint32_t>>{{0, 10}, {2, 5}, {5, 4}, {5, 4}, {5, 1}, {3, 6}}));
+    EXPECT_EQ(buy.quantity(), 0);
+    EXPECT_EQ(order_book.size(), 2);
+    EXPECT_EQ(order_book.Find(5), nullptr);
+    EXPECT_EQ(order_book.Level(SELL_OS, 100), (BookLevel{.side = SELL_OS, .price = 100, .order_count = 0, .volume = 0}));
+    EXPECT_EQ(order_book.Level(SELL_OS, 101), (BookLevel{.side = SELL_OS, .price = 101, .order_count = 1, .volume = 1}));
+    EXPECT_EQ(order_book.GetOpposite(BUY_OS)->id(), 3);
+}
+
+TEST(CancelTest, RemovesRestingOrder) {
+    MatchingSystem system;
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 0, 100, 10));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 1, 100, 20));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 2, 101, 30));
+
+    EXPECT_TRUE(system.CancelOrder(0));
+    EXPECT_FALSE(system.CancelOrder(0));
+    EXPECT_FALSE(system.CancelOrder(42));
+    EXPECT_EQ(system.order_book().GetOpposite(BUY_OS)->id(), 1);
+
+    EXPECT_TRUE(system.CancelOrder(1));
+    EXPECT_EQ(system.order_book().GetOpposite(BUY_OS)->id(), 2);
+
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 3, 101, 5));
+    EXPECT_EQ(RestingQuantity(system, 2), 25);
+    EXPECT_EQ(RestingQuantity(system, 3), 0);
+}
+
+TEST(ModifyTest, ReduceKeepsPriority) {
+    MatchingSystem system;
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 0, 100, 10));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 1, 100, 20));
+
+    EXPECT_TRUE(system.ModifyOrder(0, 100, 4));
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 2, 100, 5));
+    EXPECT_EQ(RestingQuantity(system, 0), 0);
+    EXPECT_EQ(RestingQuantity(system, 1), 19);
+}
+
+TEST(ModifyTest, IncreaseLosesPriority) {
+    MatchingSystem system;
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 0, 100, 10));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 1, 100, 20));
+
+    EXPECT_TRUE(system.ModifyOrder(0, 100, 15));
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 2, 100, 5));
+    EXPECT_EQ(RestingQuantity(system, 0), 15);
+    EXPECT_EQ(RestingQuantity(system, 1), 15);
+}
+
+TEST(ModifyTest, PriceChangeMatches) {
+    MatchingSystem system;
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 0, 101, 10));
+    system.AddOrder(IcebergOrder(OrderSide::BUY_OS, 1, 99, 30, 5));
+
+    EXPECT_TRUE(system.ModifyOrder(1, 101, 40));
+    EXPECT_EQ(RestingQuantity(system, 0), 0);
+    EXPECT_EQ(RestingQuantity(system, 1), 5);
+    EXPECT_EQ(RestingHiddenVolume(system, 1), 30);
+
+    EXPECT_TRUE(system.ModifyOrder(1, 101, 3));
+    EXPECT_EQ(RestingQuantity(system, 1), 3);
+    EXPECT_EQ(RestingHiddenVolume(system, 1), 3);
+
+    EXPECT_TRUE(system.ModifyOrder(1, 101, 0));
+    EXPECT_EQ(system.order_book().Find(1), nullptr);
+    EXPECT_FALSE(system.ModifyOrder(1, 101, 10));
+}
+
+TEST(FormattingTest, OrderCommandTest) {
+    auto cancel = OrderCommandParser::Parse("C,100322");
+    ASSERT_NE(cancel, std::nullopt);
+    EXPECT_EQ(std::get<CancelOrderRequest>(cancel.value()).id, 100322);
+
+    auto modify = OrderCommandParser::Parse("  M,100322,5103,7500");
+    ASSERT_NE(modify, std::nullopt);
+    EXPECT_EQ(std::get<ModifyOrderRequest>(modify.value()).id, 100322);
+    EXPECT_EQ(std::get<ModifyOrderRequest>(modify.value()).price, 5103);
+    EXPECT_EQ(std::get<ModifyOrderRequest>(modify.value()).quantity, 7500);
+
+    auto order = OrderCommandParser::Parse("B,100322,5103,7500");
+    ASSERT_NE(order, std::nullopt);
+    EXPECT_EQ(std::get<std::unique_ptr<LimitOrder>>(order.value())->id(), 100322);
+
+    EXPECT_EQ(OrderCommandParser::Parse("# C,100322"), std::nullopt);
+    EXPECT_EQ(OrderCommandParser::Parse("C,1,2"), std::nullopt);
+}
+
+TEST(FormattingTest, SymbolFieldTest) {
+    auto order = OrderParser::Parse("42,S,100345,5103,100000,10000");
+    ASSERT_NE(order, std::nullopt);
+    EXPECT_EQ(order.value()->symbol(), 42);
+    EXPECT_EQ(order.value()->type(), ICEBERG_ORDER);
+    EXPECT_EQ(OrderParser::Parse("B,100322,5103,7500").value()->symbol(), 0);
+
+    auto cancel = OrderCommandParser::Parse("7,C,100322");
+    ASSERT_NE(cancel, std::nullopt);
+    EXPECT_EQ(std::get<CancelOrderRequest>(cancel.value()).symbol, 7);
+    EXPECT_EQ(std::get<CancelOrderRequest>(cancel.value()).id, 100322);
+
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 0, 100, 10, 42));
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 1, 100, 4, 42));
+    system.Flush();
+    EXPECT_EQ(out.str(), "42,1,0,100,4\n");
+    EXPECT_EQ((Trade{.symbol = 42, .buy_id = 1, .sell_id = 0, .price = 100, .quantity = 4}.ToString()), "42,1,0,100,4");
+}
+
+TEST(OutputPolicyTest, TradesOnly) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 0, 100, 10));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 1, 101, 10));
+    EXPECT_EQ(out.str(), "");
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 2, 100, 4));
+    system.Flush();
+    EXPECT_EQ(out.str(), "2,0,100,4\n");
+}
+
+TEST(OutputPolicyTest, PeriodicSnapshot) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::PeriodicSnapshot(2, out));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 0, 100, 10));
+    EXPECT_EQ(out.str(), "");
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 1, 101, 10));
+    std::string first_snapshot = system.order_book().ToString();
+    EXPECT_EQ(out.str(), first_snapshot);
+    system.CancelOrder(1);
+    EXPECT_EQ(out.str(), first_snapshot);
+    system.CancelOrder(0);
+    EXPECT_EQ(out.str(), first_snapshot + system.order_book().ToString());
+}
+
+TEST(BatchTest, AddOrdersReportsPerRecordResults) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::FullSnapshot(out));
+    std::vector<OrderRecord> records = {
+        {.id = 0, .quantity = 10, .side = SELL_OS, .price = 100},
+        {.id = 1, .quantity = 50, .peak_size = 5, .type = ICEBERG_ORDER, .side = SELL_OS, .price = 101},
+        {.id = 2, .quantity = 18, .side = BUY_OS, .price = 101},
+        {.id = 1, .quantity = 1, .side = BUY_OS, .price = 90},
+        {.id = 7, .action = OrderAction::kCancel},
+        {.id = 1, .quantity = 60, .price = 99, .action = OrderAction::kModify},
+        {.id = 3, .quantity = 1, .type = static_cast<OrderType>(7), .side = BUY_OS, .price = 90},
+    };
+    std::vector<OrderResult> results = system.AddOrders(records);
+    ASSERT_EQ(results.size(), records.size());
+    EXPECT_EQ(results[0].resting_quantity, 10);
+    EXPECT_EQ(results[1].resting_quantity, 50);
+    EXPECT_EQ(results[2].filled_quantity, 18);
+    EXPECT_EQ(results[2].resting_quantity, 0);
+    EXPECT_EQ(results[3].status, OrderResult::Status::kDuplicateId);
+    EXPECT_EQ(results[4].status, OrderResult::Status::kUnknownOrder);
+    EXPECT_TRUE(results[5].accepted());
+    EXPECT_EQ(results[5].filled_quantity, 0);
+    EXPECT_EQ(results[5].resting_quantity, 60);
+    EXPECT_EQ(results[6].status, OrderResult::Status::kUnsupportedType);
+
+    // Trades of the batch come first, then a single snapshot.
+    EXPECT_EQ(out.str(), "2,0,100,10\n2,1,101,8\n" + system.order_book().ToString());
+}
+
+TEST(FormattingTest, OrderBookTopLevelsTest) {
+    OrderBook order_book;
+    order_book.Add(LimitOrder(OrderSide::BUY_OS, 1, 99, 100));
+    order_book.Add(LimitOrder(OrderSide::BUY_OS, 2, 99, 200));
+    order_book.Add(LimitOrder(OrderSide::BUY_OS, 3, 98, 300));
+    order_book.Add(LimitOrder(OrderSide::SELL_OS, 4, 101, 400));
+    order_book.Add(LimitOrder(OrderSide::SELL_OS, 5, 102, 500));
+
+    std::ostringstream expected_result;
+    expected_result << "+-----------------------------------------------------------------+\n";
+    expected_result << "| BUY                            | SELL                           |\n";
+    expected_result << "| Id       | Volume      | Price | Price | Volume      | Id       |\n";
+    expected_result << "+----------+-------------+-------+-------+-------------+----------+\n";
+    expected_result << "|         1|          100|     99|    101|          400|         4|\n";
+    expected_result << "|         2|          200|     99|       |             |          |\n";
+    expected_result << "+-----------------------------------------------------------------+\n";
+
+    EXPECT_EQ(order_book.ToString(1), expected_result.str());
+    EXPECT_EQ(order_book.ToString(2), order_book.ToString());
+}
+
+TEST(TradeSinkTest, AggregatesInFillOrder) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    system.AddOrder(IcebergOrder(OrderSide::SELL_OS, 1, 100, 20, 5));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 2, 100, 5));
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 3, 100, 30));
+    system.Flush();
+    EXPECT_EQ(out.str(), "3,1,100,20\n3,2,100,5\n");
+}
+
+TEST(TradeSinkTest, CallbackReceivesEveryFill) {
+    std::vector<std::string> trades;
+    CallbackTradeSink sink([&trades](const Trade& trade) {
+        trades.push_back(trade.ToString());
+    });
+    std::ostringstream out;
+    OutputPolicy output_policy = OutputPolicy::TradesOnly(out);
+    output_policy.aggregate_trades = false;
+    MatchingSystem system(output_policy, &sink);
+    system.AddOrder(IcebergOrder(OrderSide::SELL_OS, 1, 100, 20, 5));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 2, 100, 5));
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 3, 100, 30));
+    EXPECT_EQ(trades, std::vector<std::string>({"3,1,100,5", "3,2,100,5", "3,1,100,5", "3,1,100,5", "3,1,100,5"}));
+    EXPECT_EQ(out.str(), "");
+}
+
+TEST(TradeSinkTest, QueueSink) {
+    SpscQueue<Trade> queue(4);
+    QueueTradeSink sink(queue);
+    MatchingSystem system(OutputPolicy::TradesOnly(), &sink);
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 1, 100, 20));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 2, 99, 5));
+
+    Trade trade;
+    ASSERT_TRUE(queue.TryPop(trade));
+    EXPECT_EQ(trade.ToString(), "1,2,100,5");
+    EXPECT_FALSE(queue.TryPop(trade));
+}
+
+class RecordingSubscriber : public MarketDataSubscriber {
+public:
+    void OnLevelDelta(const LevelDelta& delta) override {
+        static constexpr const char* kKinds[] = {"add", "update", "delete"};
+        events.push_back(absl::StrFormat("%s %s %hu %u/%u", kKinds[static_cast<int>(delta.kind)], delta.level.side == BUY_OS ? "B" : "S",
+                                         delta.level.price, delta.level.volume, delta.level.order_count));
+    }
+
+    void OnBestBidOffer(const BestBidOffer& best) override {
+        events.push_back(absl::StrFormat("bbo %s %s", best.bid ? absl::StrCat(best.bid->price, "x", best.bid->volume) : "-",
+                                         best.ask ? absl::StrCat(best.ask->price, "x", best.ask->volume) : "-"));
+    }
+
+    std::vector<std::string> events;
+};
+
+TEST(MarketDataTest, PublishesLevelDeltas) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    RecordingSubscriber subscriber;
+    system.SetMarketDataSubscriber(&subscriber);
+
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 0, 101, 10));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 1, 101, 5));
+    system.AddOrder(IcebergOrder(OrderSide::SELL_OS, 2, 102, 100, 20));
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 3, 99, 7));
+    EXPECT_EQ(subscriber.events, (std::vector<std::string>{
+        "add S 101 10/1", "bbo - 101x10",
+        "update S 101 15/2", "bbo - 101x15",
+        "add S 102 20/1",
+        "add B 99 7/1", "bbo 99x7 101x15",
+    }));
+
+    subscriber.events.clear();
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 4, 102, 40));
+    EXPECT_EQ(subscriber.events, (std::vector<std::string>{
+        "delete S 101 0/0", "update S 102 15/1", "bbo 99x7 102x15",
+    }));
+
+    subscriber.events.clear();
+    system.ModifyOrder(3, 99, 2);
+    system.CancelOrder(2);
+    EXPECT_EQ(subscriber.events, (std::vector<std::string>{
+        "update B 99 2/1", "bbo 99x2 102x15",
+        "delete S 102 0/0", "bbo 99x2 -",
+    }));
+}
+
+TEST(MarketDataTest, DepthSnapshot) {
+    OrderBook book;
+    for (uint32_t id = 0; id < 10; ++id) {
+        book.Add(LimitOrder(OrderSide::BUY_OS, id, 100 - id % 5, 10 + id));
+    }
+    std::vector<BookLevel> depth = book.Depth(BUY_OS, 3);
+    ASSERT_EQ(depth.size(), 3);
+    EXPECT_EQ(depth[0], (BookLevel{.side = BUY_OS, .price = 100, .order_count = 2, .volume = 25}));
+    EXPECT_EQ(depth[1], (BookLevel{.side = BUY_OS, .price = 99, .order_count = 2, .volume = 27}));
+    EXPECT_EQ(depth[2], (BookLevel{.side = BUY_OS, .price = 98, .order_count = 2, .volume = 29}));
+    EXPECT_EQ(book.Depth(BUY_OS, 100).size(), 5);
+    EXPECT_TRUE(book.Depth(SELL_OS, 3).empty());
+}
+
+TEST(StatsTest, CountsEventsAndSweeps) {
+    std::ostringstream stats_out;
+    OutputPolicy output_policy = OutputPolicy::TradesOnly();
+    output_policy.stats_interval = 2;
+    output_policy.stats_out = &stats_out;
+    CallbackTradeSink sink([](const Trade&) {});
+    MatchingSystem system(output_policy, &sink);
+    system.AddOrder(IcebergOrder(OrderSide::SELL_OS, 1, 100, 20, 5));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 2, 101, 5));
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 3, 101, 30));
+    EXPECT_FALSE(system.CancelOrder(1));
+
+    MatchingStats stats = system.stats();
+    EXPECT_EQ(stats.events, 4);
+    EXPECT_EQ(stats.latency_ticks.count(), 4);
+    EXPECT_EQ(stats.fills_per_aggressor.count(), 1);
+    EXPECT_EQ(stats.fills_per_aggressor.max(), 5);
+    EXPECT_EQ(stats.book.levels_swept, 2);
+    EXPECT_EQ(stats.book.fills, 5);
+    EXPECT_EQ(stats.book.iceberg_replenishments, 3);
+    EXPECT_EQ(stats.book.resting_orders, 1);
+    EXPECT_EQ(stats.book.bid_levels, 1);
+    EXPECT_EQ(stats.book.ask_levels, 0);
+    EXPECT_EQ(stats.book.allocated_slabs, 1);
+    std::string dumps = stats_out.str();
+    EXPECT_EQ(std::count(dumps.begin(), dumps.end(), '\n'), 2);
+    EXPECT_NE(dumps.find("events=4 "), std::string::npos);
+}
+
+TEST(ImmediateOrderTest, RemainderIsDropped) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 0, 100, 10));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 1, 102, 10));
+
+    system.AddOrder(ImmediateOrder(IOC_ORDER, OrderSide::BUY_OS, 2, 101, 15));
+    EXPECT_EQ(system.order_book().Find(2), nullptr);
+    EXPECT_EQ(system.order_book().size(), 1);
+
+    system.AddOrder(ImmediateOrder(MARKET_ORDER, OrderSide::BUY_OS, 3, 0, 25));
+    EXPECT_EQ(system.order_book().size(), 0);
+    system.Flush();
+    EXPECT_EQ(out.str(), "2,0,100,10\n3,1,102,10\n");
+}
+
+TEST(ImmediateOrderTest, FillOrKillChecksLiquidityFirst) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    RecordingSubscriber subscriber;
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 0, 100, 10));
+    system.AddOrder(IcebergOrder(OrderSide::BUY_OS, 1, 99, 20, 5));
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 2, 98, 10));
+    system.SetMarketDataSubscriber(&subscriber);
+
+    // Hidden volume counts, the level beyond the limit does not.
+    OrderRecord kill{.id = 3, .quantity = 31, .type = FOK_ORDER, .side = SELL_OS, .price = 99};
+    OrderResult killed = system.AddOrders(std::span(&kill, 1))[0];
+    EXPECT_TRUE(killed.accepted());
+    EXPECT_EQ(killed.filled_quantity, 0);
+    EXPECT_TRUE(subscriber.events.empty());
+    EXPECT_EQ(RestingHiddenVolume(system, 1), 20);
+
+    OrderRecord fill{.id = 4, .quantity = 30, .type = FOK_ORDER, .side = SELL_OS, .price = 99};
+    EXPECT_EQ(system.AddOrders(std::span(&fill, 1))[0].filled_quantity, 30);
+    EXPECT_EQ(system.order_book().size(), 1);
+    EXPECT_EQ(system.order_book().Find(4), nullptr);
+}
+
+TEST(ImmediateOrderTest, ParsesTypeField) {
+    auto ioc = OrderParser::Parse("B,1,100,10,IOC");
+    ASSERT_NE(ioc, std::nullopt);
+    EXPECT_EQ(ioc.value()->type(), IOC_ORDER);
+    EXPECT_EQ(ioc.value()->price(), 100);
+
+    auto market = OrderParser::Parse("7,S,2,0,10,MARKET");
+    ASSERT_NE(market, std::nullopt);
+    EXPECT_EQ(market.value()->type(), MARKET_ORDER);
+    EXPECT_EQ(market.value()->price(), 0);
+    EXPECT_EQ(market.value()->symbol(), 7);
+    EXPECT_EQ(OrderParser::Parse("B,3,0,10,MARKET").value()->price(), std::numeric_limits<uint16_t>::max());
+    EXPECT_EQ(OrderParser::Parse("B,4,100,10,FOK").value()->type(), FOK_ORDER);
+}
+
+// Participant 1 rests 10 at 100 and 10 at 101 behind participant 2's 5 at 100,
+// then buys 30 up to 101.
+std::string RunSelfTrade(SelfTradePrevention mode, MatchingSystem& system, std::ostringstream& out) {
+    system.SetSelfTradePrevention(mode);
+    std::vector<OrderRecord> records = {
+        {.id = 0, .quantity = 10, .side = SELL_OS, .price = 100, .participant = 1},
+        {.id = 1, .quantity = 5, .side = SELL_OS, .price = 100, .participant = 2},
+        {.id = 2, .quantity = 10, .side = SELL_OS, .price = 101, .participant = 3},
+        {.id = 3, .quantity = 30, .side = BUY_OS, .price = 101, .participant = 1},
+    };
+    system.AddOrders(records);
+    return out.str();
+}
+
+TEST(SelfTradePreventionTest, CancelNewest) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    EXPECT_EQ(RunSelfTrade(SelfTradePrevention::kCancelNewest, system, out), "");
+    EXPECT_EQ(system.order_book().Find(3), nullptr);
+    EXPECT_EQ(system.order_book().size(), 3);
+    EXPECT_EQ(system.stats().book.self_trades_prevented, 1);
+}
+
+TEST(SelfTradePreventionTest, CancelOldest) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    EXPECT_EQ(RunSelfTrade(SelfTradePrevention::kCancelOldest, system, out), "3,1,100,5\n3,2,101,10\n");
+    EXPECT_EQ(system.order_book().Find(0), nullptr);
+    ASSERT_NE(system.order_book().Find(3), nullptr);
+    EXPECT_EQ(system.order_book().Find(3)->quantity(), 15);
+    EXPECT_EQ(system.order_book().Participant(3), 1);
+    EXPECT_EQ(system.order_book().Level(SELL_OS, 100).order_count, 0);
+}
+
+TEST(SelfTradePreventionTest, DecrementBoth) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    EXPECT_EQ(RunSelfTrade(SelfTradePrevention::kDecrementBoth, system, out), "3,1,100,5\n3,2,101,10\n");
+    EXPECT_EQ(system.order_book().Find(0), nullptr);
+    EXPECT_EQ(system.order_book().Find(3)->quantity(), 5);
+    EXPECT_EQ(system.order_book().Level(SELL_OS, 100).volume, 0);
+
+    // Only traded quantity counts as filled.
+    system.Apply({.id = 5, .quantity = 4, .side = SELL_OS, .price = 102, .participant = 1});
+    system.Apply({.id = 6, .quantity = 4, .side = SELL_OS, .price = 102, .participant = 2});
+    OrderRecord buy{.id = 4, .quantity = 10, .side = BUY_OS, .price = 102, .participant = 1};
+    OrderResult result = system.AddOrders(std::span(&buy, 1))[0];
+    EXPECT_EQ(result.filled_quantity, 4);
+    EXPECT_EQ(result.resting_quantity, 2);
+}
+
+TEST(SelfTradePreventionTest, FillOrKillDoesNotCountOwnOrders) {
+    for (SelfTradePrevention mode : {SelfTradePrevention::kCancelNewest, SelfTradePrevention::kCancelOldest, SelfTradePrevention::kDecrementBoth}) {
+        std::ostringstream out;
+        MatchingSystem system(OutputPolicy::TradesOnly(out));
+        system.SetSelfTradePrevention(mode);
+        system.Apply({.id = 1, .quantity = 10, .side = SELL_OS, .price = 100, .participant = 2});
+        system.Apply({.id = 2, .quantity = 10, .side = SELL_OS, .price = 100, .participant = 1});
+
+        // Only participant 2's order is there to trade with.
+        OrderRecord kill{.id = 3, .quantity = 20, .type = FOK_ORDER, .side = BUY_OS, .price = 100, .participant = 1};
+        OrderResult killed = system.AddOrders(std::span(&kill, 1))[0];
+        EXPECT_EQ(killed.filled_quantity, 0);
+        EXPECT_EQ(out.str(), "");
+        EXPECT_EQ(system.order_book().size(), 2);
+        EXPECT_EQ(system.stats().book.self_trades_prevented, 0);
+
+        // Behind the own order: cancel-oldest removes it and trades on, the
+        // other modes would act on it before the fill completes.
+        system.Apply({.id = 4, .quantity = 10, .side = SELL_OS, .price = 101, .participant = 2});
+        OrderRecord fok{.id = 5, .quantity = 20, .type = FOK_ORDER, .side = BUY_OS, .price = 101, .participant = 1};
+        OrderResult result = system.AddOrders(std::span(&fok, 1))[0];
+        if (mode == SelfTradePrevention::kCancelOldest) {
+            EXPECT_EQ(result.filled_quantity, 20);
+            EXPECT_EQ(out.str(), "5,1,100,10\n5,4,101,10\n");
+            EXPECT_EQ(system.order_book().size(), 0);
+        } else {
+            EXPECT_EQ(result.filled_quantity, 0);
+            EXPECT_EQ(out.str(), "");
+            EXPECT_EQ(system.order_book().size(), 3);
+        }
+
+        // Volume ahead of the own order fills in every mode.
+        system.Apply({.id = 6, .quantity = 10, .side = SELL_OS, .price = 102, .participant = 2});
+        OrderRecord fill{.id = 7, .quantity = 5, .type = FOK_ORDER, .side = BUY_OS, .price = 102, .participant = 1};
+        EXPECT_EQ(system.AddOrders(std::span(&fill, 1))[0].filled_quantity, 5);
+    }
+}
+
+TEST(SelfTradePreventionTest, TracksParticipants) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    system.TrackParticipants();
+    RunSelfTrade(SelfTradePrevention::kNone, system, out);
+    ParticipantStats buyer = system.participant_stats(1);
+    EXPECT_EQ(buyer.bought, 25);
+    EXPECT_EQ(buyer.sold, 10);
+    EXPECT_EQ(buyer.bought_notional, 15 * 100 + 10 * 101);
+    EXPECT_EQ(buyer.position(), 15);
+    EXPECT_EQ(buyer.volume(), 35);
+    EXPECT_EQ(system.participant_stats(3).sold_notional, 10 * 101);
+    EXPECT_EQ(system.participant_stats(3).position(), -10);
+    EXPECT_EQ(system.participant_stats(9), ParticipantStats{});
+
+    // A modification keeps the participant.
+    system.ModifyOrder(3, 90, 7);
+    EXPECT_EQ(system.order_book().Participant(3), 1);
+    OrderRecord invalid{.id = 8, .quantity = 1, .price = 1, .participant = MatchingSystem::kMaxParticipant + 1};
+    EXPECT_EQ(system.AddOrders(std::span(&invalid, 1))[0].status, OrderResult::Status::kInvalidParticipant);
+}
+
+TEST(DepthQueryTest, VolumeWithinAndEstimateFill) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 0, 100, 10));
+    system.AddOrder(IcebergOrder(OrderSide::SELL_OS, 1, 101, 50, 5));
+    system.AddOrder(LimitOrder(OrderSide::SELL_OS, 2, 103, 20));
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 3, 98, 30));
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 4, 97, 5));
+    const OrderBook& book = system.order_book();
+
+    EXPECT_EQ(book.VolumeWithin(SELL_OS, 0), 10);
+    EXPECT_EQ(book.VolumeWithin(SELL_OS, 2), 60);
+    EXPECT_EQ(book.VolumeWithin(SELL_OS, 3), 80);
+    EXPECT_EQ(book.VolumeWithin(BUY_OS, 1), 35);
+
+    FillEstimate buy = book.EstimateFill(BUY_OS, 30);
+    EXPECT_EQ(buy.quantity, 30);
+    EXPECT_EQ(buy.notional, 10 * 100 + 20 * 101);
+    EXPECT_EQ(buy.worst_price, 101);
+    EXPECT_DOUBLE_EQ(buy.vwap(), (10 * 100 + 20 * 101) / 30.0);
+    FillEstimate all = book.EstimateFill(BUY_OS, 1000);
+    EXPECT_EQ(all.quantity, 80);
+    EXPECT_EQ(all.notional, 10 * 100 + 50 * 101 + 20 * 103);
+    FillEstimate sell = book.EstimateFill(SELL_OS, 32);
+    EXPECT_EQ(sell.notional, 30 * 98 + 2 * 97);
+    EXPECT_EQ(sell.worst_price, 97);
+
+    // The trees follow fills, replenishments, cancels and reductions.
+    system.AddOrder(LimitOrder(OrderSide::BUY_OS, 5, 101, 15));
+    EXPECT_EQ(book.VolumeWithin(SELL_OS, 0), 45);
+    system.CancelOrder(2);
+    system.ModifyOrder(1, 101, 40);
+    EXPECT_EQ(book.VolumeWithin(SELL_OS, 100), 40);
+    EXPECT_EQ(book.EstimateFill(BUY_OS, 100).notional, 40 * 101);
+    system.CancelOrder(1);
+    EXPECT_EQ(book.EstimateFill(BUY_OS, 1).quantity, 0);
+    EXPECT_EQ(book.VolumeWithin(SELL_OS, 100), 0);
+}
+
+TEST(DepthQueryTest, MatchesLevelWalk) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    std::mt19937 random(7);
+    auto check = [&system] {
+        for (OrderSide side : {BUY_OS, SELL_OS}) {
+            std::map<uint16_t, uint64_t> levels;
+            system.order_book().ForEachOrder([&](const LimitOrder& order) {
+                if (order.side() == side) {
+                    levels[order.price()] += order.hidden_full_volume();
+                }
+            });
+            std::vector<std::pair<uint16_t, uint64_t>> ladder(levels.begin(), levels.end());
+            if (side == BUY_OS) {
+                std::reverse(ladder.begin(), ladder.end());
+            }
+            for (uint64_t quantity : {1, 50, 500, 5000}) {
+                FillEstimate expected;
+                for (auto [price, volume] : ladder) {
+                    uint64_t taken = std::min(volume, quantity - expected.quantity);
+                    if (taken == 0) {
+                        break;
+                    }
+                    expected.quantity += taken;
+                    expected.notional += taken * price;
+                    expected.worst_price = price;
+                }
+                FillEstimate actual = system.order_book().EstimateFill(side == BUY_OS ? SELL_OS : BUY_OS, quantity);
+                EXPECT_EQ(actual.quantity, expected.quantity);
+                EXPECT_EQ(actual.notional, expected.notional);
+                EXPECT_EQ(actual.worst_price, expected.worst_price);
+            }
+            uint64_t within = 0;
+            for (auto [price, volume] : ladder) {
+                within += std::abs(price - ladder.front().first) <= 3 ? volume : 0;
+            }
+            EXPECT_EQ(system.order_book().VolumeWithin(side, 3), within);
+        }
+    };
+    for (uint32_t id = 0; id < 3000; ++id) {
+        OrderSide side = random() % 2 ? BUY_OS : SELL_OS;
+        // Clusters far apart, so the levels span pages of the ladders and trees.
+        uint16_t price = 90 + random() % 20 + (random() % 8) * 1500;
+        uint32_t quantity = 1 + random() % 100;
+        if (random() % 4 == 0) {
+            system.AddOrder(IcebergOrder(side, id, price, quantity * 5, quantity));
+        } else {
+            system.AddOrder(LimitOrder(side, id, price, quantity));
+        }
+        if (random() % 3 == 0) {
+            system.CancelOrder(random() % (id + 1));
+        }
+        if (id % 100 == 0) {
+            check();
+        }
+    }
+}
+
+TEST(CapacityTest, RejectsBeyondLimits) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    system.Preallocate({.max_resting_orders = 2, .max_pending_trades = 1, .max_participant = 3});
+    std::vector<OrderRecord> records = {
+        {.id = 0, .quantity = 10, .side = SELL_OS, .price = 100, .participant = 3},
+        {.id = 1, .quantity = 10, .side = SELL_OS, .price = 101},
+        // Orders that do not rest are taken by a full book.
+        {.id = 2, .quantity = 5, .side = BUY_OS, .price = 101},
+        {.id = 3, .quantity = 5, .side = BUY_OS, .price = 90, .participant = 4},
+        {.id = 3, .quantity = 5, .side = BUY_OS, .price = 90},
+        {.id = 4, .quantity = 5, .type = IOC_ORDER, .side = BUY_OS, .price = 100},
+        {.id = 5, .quantity = 15, .side = BUY_OS, .price = 101},
+    };
+    std::vector<OrderResult> results = system.AddOrders(records);
+    EXPECT_TRUE(results[2].accepted());
+    EXPECT_EQ(results[2].filled_quantity, 5);
+    EXPECT_EQ(results[3].status, OrderResult::Status::kInvalidParticipant);
+    EXPECT_EQ(results[4].status, OrderResult::Status::kCapacityExceeded);
+    EXPECT_EQ(results[4].filled_quantity, 0);
+    EXPECT_EQ(system.order_book().Find(3), nullptr);
+    EXPECT_TRUE(results[5].accepted());
+    EXPECT_EQ(results[5].filled_quantity, 5);
+    EXPECT_TRUE(results[6].accepted());
+    EXPECT_EQ(results[6].filled_quantity, 10);
+    EXPECT_EQ(results[6].resting_quantity, 5);
+    EXPECT_EQ(out.str(), "2,0,100,5\n4,0,100,5\n5,1,101,10\n");
+
+    MemoryStats memory = system.memory_stats();
+    EXPECT_GE(memory.order_capacity, 2);
+    EXPECT_GT(memory.price_ladders, 0);
+    EXPECT_EQ(memory.total(), memory.order_pool + memory.order_index + memory.price_ladders + memory.market_data +
+                                  memory.pending_trades + memory.participants);
+}
+
+TEST(CapacityTest, ApplyPublishesLikeAddOrders) {
+    struct Engine {
+        std::vector<std::string> trades;
+        CallbackTradeSink sink{[this](const Trade& trade) { trades.push_back(trade.ToString()); }};
+        RecordingSubscriber subscriber;
+        MatchingSystem system{OutputPolicy::TradesOnly(), &sink};
+    };
+    Engine applied;
+    Engine batched;
+    for (Engine* engine : {&applied, &batched}) {
+        engine->system.Preallocate({.max_resting_orders = 2});
+        engine->system.SetMarketDataSubscriber(&engine->subscriber);
+    }
+    std::vector<OrderRecord> records = {
+        {.id = 0, .quantity = 5, .side = SELL_OS, .price = 100},
+        {.id = 1, .quantity = 5, .side = SELL_OS, .price = 101},
+        {.id = 2, .quantity = 3, .side = BUY_OS, .price = 100},
+        // The book is full and nothing crosses: dropped without a change.
+        {.id = 3, .quantity = 4, .side = BUY_OS, .price = 99},
+        {.id = 4, .quantity = 12, .side = BUY_OS, .price = 101},
+    };
+    size_t capacity_rejects = 0;
+    for (const OrderRecord& record : records) {
+        uint64_t level_changes = applied.system.order_book().level_changes();
+        bool accepted = applied.system.Apply(record);
+        OrderResult result = batched.system.AddOrders(std::span(&record, 1))[0];
+        EXPECT_EQ(accepted, result.accepted()) << record.id;
+        EXPECT_EQ(applied.trades, batched.trades) << record.id;
+        EXPECT_EQ(applied.subscriber.events, batched.subscriber.events) << record.id;
+        if (result.status == OrderResult::Status::kCapacityExceeded) {
+            ++capacity_rejects;
+            EXPECT_EQ(applied.system.order_book().level_changes(), level_changes);
+        }
+    }
+    EXPECT_EQ(capacity_rejects, 1);
+    EXPECT_EQ(applied.trades, (std::vector<std::string>{"2,0,100,3", "4,0,100,2", "4,1,101,5"}));
+    EXPECT_EQ(applied.subscriber.events.back(), "bbo 101x5 -");
+}
+
+TEST(CapacityTest, PreallocatedEngineDoesNotAllocate) {
+    uint64_t trades = 0;
+    CallbackTradeSink sink([&trades](const Trade&) {
+        ++trades;
+    });
+    struct CountingSubscriber : MarketDataSubscriber {
+        void OnLevelDelta(const LevelDelta&) override {
+            ++deltas;
+        }
+        uint64_t deltas = 0;
+    } subscriber;
+    MatchingSystem system(OutputPolicy::TradesOnly(), &sink);
+    // Batches change more levels than that, so market data goes out early.
+    system.Preallocate({.max_resting_orders = 2000, .max_pending_trades = 8, .max_touched_levels = 8, .max_participant = 7});
+    system.SetMarketDataSubscriber(&subscriber);
+    system.SetSelfTradePrevention(SelfTradePrevention::kCancelOldest);
+    system.TrackParticipants();
+
+    std::mt19937 random(11);
+    std::vector<OrderRecord> records;
+    for (uint32_t id = 0; id < 40000; ++id) {
+        uint32_t kind = random() % 10;
+        OrderRecord record{.id = id, .quantity = 1 + static_cast<uint32_t>(random() % 200), .side = random() % 2 ? BUY_OS : SELL_OS,
+                           .price = static_cast<uint16_t>(90 + random() % 20), .participant = static_cast<uint32_t>(random() % 8)};
+        if (kind < 2) {
+            record = {.id = static_cast<uint32_t>(random() % (id + 1)), .action = OrderAction::kCancel};
+        } else if (kind < 3) {
+            record.id = static_cast<uint32_t>(random() % (id + 1));
+            record.action = OrderAction::kModify;
+        } else if (kind < 5) {
+            record.type = ICEBERG_ORDER;
+            record.peak_size = 1 + record.quantity / 5;
+        }
+        records.push_back(record);
+    }
+    std::vector<OrderResult> results(records.size());
+    const size_t kWarmup = 10000;
+    system.AddOrders(std::span(records).first(kWarmup), results);
+    MemoryStats memory = system.memory_stats();
+    uint64_t allocations_before = allocations.load();
+    for (size_t i = kWarmup; i < records.size(); i += 1000) {
+        system.AddOrders(std::span(records).subspan(i, 1000), results);
+    }
+    EXPECT_EQ(allocations.load(), allocations_before);
+    EXPECT_GT(subscriber.deltas, 0);
+    EXPECT_EQ(system.memory_stats().total(), memory.total());
+    EXPECT_GT(trades, 0);
+    EXPECT_GT(system.stats().book.self_trades_prevented, 0);
+}
+
+TEST(CapacityTest, SweepBeyondTouchedLevelsDoesNotAllocate) {
+    uint64_t trades = 0;
+    CallbackTradeSink sink([&trades](const Trade&) {
+        ++trades;
+    });
+    struct CountingSubscriber : MarketDataSubscriber {
+        void OnLevelDelta(const LevelDelta& delta) override {
+            deleted += delta.kind == LevelDelta::Kind::kDelete;
+        }
+        uint64_t deleted = 0;
+    } subscriber;
+    MatchingSystem system(OutputPolicy::TradesOnly(), &sink);
+    const uint32_t kTouchedLevels = 4;
+    const uint32_t kLevels = 5 * kTouchedLevels;
+    system.Preallocate({.max_resting_orders = 64, .max_pending_trades = 8, .max_touched_levels = kTouchedLevels});
+    system.SetMarketDataSubscriber(&subscriber);
+    std::vector<OrderRecord> records;
+    for (uint32_t id = 0; id < kLevels; ++id) {
+        records.push_back({.id = id, .quantity = 10, .side = SELL_OS, .price = static_cast<uint16_t>(100 + id)});
+    }
+    std::vector<OrderResult> results(records.size());
+    system.AddOrders(records, results);
+    subscriber.deleted = 0;
+
+    // One order clears more levels than twice the reservation.
+    OrderRecord sweep{.id = kLevels, .quantity = 10 * kLevels, .side = BUY_OS, .price = static_cast<uint16_t>(100 + kLevels)};
+    uint64_t allocations_before = allocations.load();
+    system.AddOrders(std::span(&sweep, 1), results);
+    EXPECT_EQ(allocations.load(), allocations_before);
+    EXPECT_EQ(results[0].filled_quantity, 10 * kLevels);
+    EXPECT_EQ(trades, kLevels);
+    EXPECT_EQ(subscriber.deleted, kLevels);
+    EXPECT_EQ(system.order_book().size(), 0);
+}
+
+TEST(CapacityTest, PriceLaddersGrowWithThePricesUsed) {
+    std::ostringstream out;
+    MatchingSystem system(OutputPolicy::TradesOnly(out));
+    size_t empty = system.memory_stats().price_ladders;
+    EXPECT_LT(empty, 32 * 1024);
+    system.AddOrder(LimitOrder(SELL_OS, 1, 101, 10));
+    system.AddOrder(LimitOrder(BUY_OS, 2, 99, 10));
+    size_t thin = system.memory_stats().price_ladders;
+    EXPECT_GT(thin, empty);
+    EXPECT_LT(thin, 64 * 1024);
+    system.AddOrder(LimitOrder(SELL_OS, 3, 60000, 10));
+    EXPECT_GT(system.memory_stats().price_ladders, thin);
+    system.Preallocate({.max_resting_orders = 16});
+    EXPECT_GT(system.memory_stats().price_ladders, 6'000'000);
+
+    // Orders within a preallocated range do not allocate.
+    MatchingSystem ranged(OutputPolicy::TradesOnly(out));
+    ranged.Preallocate({.max_resting_orders = 16, .max_pending_trades = 4, .min_price = 1000, .max_price = 1999});
+    size_t reserved = ranged.memory_stats().price_ladders;
+    EXPECT_LT(reserved, 256 * 1024);
+    std::vector<OrderRecord> records = {
+        {.id = 1, .quantity = 10, .side = SELL_OS, .price = 1999},
+        {.id = 2, .quantity = 10, .side = BUY_OS, .price = 1000},
+        {.id = 3, .quantity = 15, .side = SELL_OS, .price = 1000},
+    };
+    std::vector<OrderResult> results(records.size());
+    uint64_t allocations_before = allocations.load();
+    ranged.AddOrders(records, results);
+    EXPECT_EQ(allocations.load(), allocations_before);
+    EXPECT_EQ(results[2].filled_quantity, 10);
+    EXPECT_EQ(ranged.memory_stats().price_ladders, reserved);
+}
+
+TEST(FormattingTest, CsvTradeWriterTest) {
+    std::ostringstream out;
+    {
+        CsvTradeWriter writer(out, 1);
+        writer.OnTrade(Trade{.buy_id = 100322, .sell_id = 100345, .price = 5103, .quantity = 7500});
+        writer.OnTrade(Trade{.buy_id = 4294967295, .sell_id = 0, .price = 65535, .quantity = 4294967295});
+    }
+    EXPECT_EQ(out.str(), "100322,100345,5103,7500\n4294967295,0,65535,4294967295\n");
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     ::testing::GTEST_FLAG(output) = "stdout";
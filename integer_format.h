@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+
+// Integer formatting for the output paths that run once per trade or per book
+// row, where absl::StrFormat and temporary strings would dominate the cost.
+
+// Writes the decimal digits of `value` at `out` and returns the position past the last one.
+inline char* FormatUnsigned(uint64_t value, char* out) {
+    char digits[20];
+    char* begin = std::end(digits);
+    do {
+        *--begin = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    return std::copy(begin, std::end(digits), out);
+}
+
+// Like FormatUnsigned, with a comma between groups of three digits: 1234567
+// becomes "1,234,567". Writes at most 26 characters.
+inline char* FormatGrouped(uint64_t value, char* out) {
+    char digits[26];
+    char* begin = std::end(digits);
+    int in_group = 0;
+    do {
+        if (in_group == 3) {
+            *--begin = ',';
+            in_group = 0;
+        }
+        *--begin = static_cast<char>('0' + value % 10);
+        value /= 10;
+        ++in_group;
+    } while (value);
+    return std::copy(begin, std::end(digits), out);
+}
+
+// Appends `text` right-aligned in a field of `width` characters.
+inline void AppendPadded(std::string& out, std::string_view text, size_t width) {
+    if (text.size() < width) {
+        out.append(width - text.size(), ' ');
+    }
+    out.append(text);
+}
+
+inline void AppendUnsigned(std::string& out, uint64_t value, size_t width = 0) {
+    char buffer[20];
+    AppendPadded(out, std::string_view(buffer, FormatUnsigned(value, buffer) - buffer), width);
+}
+
+inline void AppendGrouped(std::string& out, uint64_t value, size_t width = 0) {
+    char buffer[26];
+    AppendPadded(out, std::string_view(buffer, FormatGrouped(value, buffer) - buffer), width);
+}
@@ -0,0 +1,413 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <glog/logging.h>
+#include "absl/strings/str_format.h"
+#include "homework.h"
+#include "mapped_file.h"
+
+
+// Binary journal of order and trade events: a JournalHeader followed by
+// fixed-width little-endian PackedJournalRecords, so record i sits at a known
+// offset and a journal can be read from any record on.
+static_assert(std::endian::native == std::endian::little, "Journal records are stored in host byte order");
+
+struct JournalHeader {
+    static constexpr char kMagic[8] = {'O', 'B', 'J', 'R', 'N', 'L', '\0', '\0'};
+    static constexpr uint32_t kVersion = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+enum class JournalRecordKind : uint8_t {
+    kAddOrder,
+    kCancelOrder,
+    kModifyOrder,
+    kTrade,
+};
+
+// One journal event as it is written and read back.
+struct JournalRecord {
+    JournalRecordKind kind;
+    uint8_t side;   // OrderSide of orders.
+    uint8_t type;   // OrderType of orders.
+    uint16_t price;
+    uint32_t id;         // Buy order id for trades.
+    uint32_t quantity;
+    uint32_t auxiliary;  // Peak size of icebergs, sell order id for trades.
+    uint32_t symbol;
+    uint32_t participant;  // Of added orders.
+
+    static JournalRecord FromOrder(const OrderRecord& order) {
+        JournalRecordKind kind = JournalRecordKind::kAddOrder;
+        if (order.action == OrderAction::kCancel) {
+            kind = JournalRecordKind::kCancelOrder;
+        } else if (order.action == OrderAction::kModify) {
+            kind = JournalRecordKind::kModifyOrder;
+        }
+        return JournalRecord{
+            .kind = kind,
+            .side = static_cast<uint8_t>(order.side),
+            .type = static_cast<uint8_t>(order.type),
+            .price = order.price,
+            .id = order.id,
+            .quantity = order.quantity,
+            .auxiliary = order.peak_size,
+            .symbol = order.symbol,
+            .participant = order.participant,
+        };
+    }
+
+    static JournalRecord FromTrade(const Trade& trade) {
+        return JournalRecord{
+            .kind = JournalRecordKind::kTrade,
+            .price = trade.price,
+            .id = trade.buy_id,
+            .quantity = trade.quantity,
+            .auxiliary = trade.sell_id,
+            .symbol = trade.symbol,
+        };
+    }
+
+    bool is_order() const {
+        return kind != JournalRecordKind::kTrade;
+    }
+
+    // False for a kind, side or order type no writer produces.
+    bool IsValid() const {
+        return kind <= JournalRecordKind::kTrade && side <= SELL_OS && (!is_order() || OrderType_IsValid(type));
+    }
+
+    OrderRecord ToOrder() const {
+        OrderRecord order{
+            .symbol = symbol,
+            .id = id,
+            .quantity = quantity,
+            .peak_size = auxiliary,
+            .type = static_cast<OrderType>(type),
+            .side = static_cast<OrderSide>(side),
+            .price = price,
+            .participant = participant,
+        };
+        if (kind == JournalRecordKind::kCancelOrder) {
+            order.action = OrderAction::kCancel;
+        } else if (kind == JournalRecordKind::kModifyOrder) {
+            order.action = OrderAction::kModify;
+        }
+        return order;
+    }
+
+    Trade ToTrade() const {
+        return Trade{.symbol = symbol, .buy_id = id, .sell_id = auxiliary, .price = price, .quantity = quantity};
+    }
+};
+
+static_assert(sizeof(JournalHeader) == 16 && std::is_trivially_copyable_v<JournalHeader>);
+
+
+// On-disk form of a JournalRecord. The kind, side, type, participant and
+// symbol share 48 bits: kind in bits 0-1, side in 2, type in 3-5, participant
+// in 6-25 and symbol in 26-47.
+struct PackedJournalRecord {
+    static constexpr uint32_t kMaxParticipant = (1 << 20) - 1;
+    static constexpr uint32_t kMaxSymbol = (1 << 22) - 1;
+
+    uint32_t id;
+    uint32_t quantity;
+    uint32_t auxiliary;
+    uint16_t price;
+    uint8_t packed[6];
+
+    // False if the participant or symbol of `record` does not fit.
+    static bool Pack(const JournalRecord& record, PackedJournalRecord* out) {
+        if (record.participant > kMaxParticipant || record.symbol > kMaxSymbol) {
+            return false;
+        }
+        uint64_t bits = static_cast<uint64_t>(record.kind) | uint64_t{record.side & 1u} << 2 | uint64_t{record.type & 7u} << 3 |
+                        uint64_t{record.participant} << 6 | uint64_t{record.symbol} << 26;
+        out->id = record.id;
+        out->quantity = record.quantity;
+        out->auxiliary = record.auxiliary;
+        out->price = record.price;
+        std::memcpy(out->packed, &bits, sizeof(out->packed));
+        return true;
+    }
+
+    JournalRecord Unpack() const {
+        uint64_t bits = 0;
+        std::memcpy(&bits, packed, sizeof(packed));
+        return JournalRecord{
+            .kind = static_cast<JournalRecordKind>(bits & 3),
+            .side = static_cast<uint8_t>(bits >> 2 & 1),
+            .type = static_cast<uint8_t>(bits >> 3 & 7),
+            .price = price,
+            .id = id,
+            .quantity = quantity,
+            .auxiliary = auxiliary,
+            .symbol = static_cast<uint32_t>(bits >> 26),
+            .participant = static_cast<uint32_t>(bits >> 6 & kMaxParticipant),
+        };
+    }
+};
+
+static_assert(sizeof(PackedJournalRecord) == 20 && std::is_trivially_copyable_v<PackedJournalRecord>);
+static_assert(PackedJournalRecord::kMaxParticipant == MatchingSystem::kMaxParticipant);
+
+
+class JournalWriter {
+public:
+    static std::optional<JournalWriter> Open(const std::string& path, std::string* error) {
+        JournalWriter writer;
+        writer.out_.open(path, std::ios::binary | std::ios::trunc);
+        if (!writer.out_) {
+            *error = absl::StrFormat("Cannot create %s", path);
+            return std::nullopt;
+        }
+        JournalHeader header{.version = JournalHeader::kVersion, .record_size = sizeof(PackedJournalRecord)};
+        std::memcpy(header.magic, JournalHeader::kMagic, sizeof(header.magic));
+        writer.out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        return writer;
+    }
+
+    JournalWriter(JournalWriter&&) = default;
+    JournalWriter& operator=(JournalWriter&&) = default;
+
+    ~JournalWriter() {
+        Flush();
+    }
+
+    // Returns false, writing nothing, if the participant or symbol of
+    // `record` is beyond what PackedJournalRecord holds.
+    bool Append(const JournalRecord& record) {
+        PackedJournalRecord packed;
+        if (!PackedJournalRecord::Pack(record, &packed)) {
+            ++refused_;
+            return false;
+        }
+        if (buffer_.size() == kBufferRecords) {
+            Flush();
+        }
+        buffer_.push_back(packed);
+        ++records_;
+        return true;
+    }
+
+    bool Append(const OrderRecord& order) {
+        return Append(JournalRecord::FromOrder(order));
+    }
+
+    bool Append(const Trade& trade) {
+        return Append(JournalRecord::FromTrade(trade));
+    }
+
+    // Returns false if any write failed so far.
+    bool Flush() {
+        if (!buffer_.empty()) {
+            out_.write(reinterpret_cast<const char*>(buffer_.data()), buffer_.size() * sizeof(PackedJournalRecord));
+            buffer_.clear();
+        }
+        out_.flush();
+        return static_cast<bool>(out_);
+    }
+
+    uint64_t records() const {
+        return records_;
+    }
+
+    // Records Append did not write.
+    uint64_t refused() const {
+        return refused_;
+    }
+
+private:
+    static constexpr size_t kBufferRecords = 64 * 1024;
+
+    JournalWriter() {
+        buffer_.reserve(kBufferRecords);
+    }
+
+    std::ofstream out_;
+    std::vector<PackedJournalRecord> buffer_;
+    uint64_t records_ = 0;
+    uint64_t refused_ = 0;
+};
+
+
+// Maps a journal and decodes its records in place. Records are fixed-width, so
+// any run of them can be read on its own, for example to split a journal
+// between threads. Open() only checks the header and that the file holds whole
+// records; each record is checked as it is decoded, and iteration stops at a
+// damaged one, reporting it through `error`.
+class JournalReader {
+public:
+    class Iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = JournalRecord;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const JournalRecord*;
+        using reference = const JournalRecord&;
+
+        Iterator() = default;
+
+        const JournalRecord& operator*() const {
+            return record_;
+        }
+
+        const JournalRecord* operator->() const {
+            return &record_;
+        }
+
+        Iterator& operator++() {
+            position_ += sizeof(PackedJournalRecord);
+            Load();
+            return *this;
+        }
+
+        void operator++(int) {
+            ++*this;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return position_ == other.position_;
+        }
+
+    private:
+        friend class JournalReader;
+
+        Iterator(const JournalReader* reader, const char* position, const char* end, std::string* error)
+            : reader_(reader), position_(position), end_(end), error_(error) {
+            Load();
+        }
+
+        // Decodes the record at position_, unless it is the end. A damaged
+        // record ends the iteration.
+        void Load() {
+            if (position_ == end_) {
+                return;
+            }
+            PackedJournalRecord packed;
+            std::memcpy(&packed, position_, sizeof(packed));
+            record_ = packed.Unpack();
+            if (!record_.IsValid()) {
+                *error_ = absl::StrFormat("%s has a damaged record %u", reader_->path_, (position_ - reader_->first_record()) / sizeof(PackedJournalRecord));
+                position_ = end_;
+            }
+        }
+
+        const JournalReader* reader_ = nullptr;
+        const char* position_ = nullptr;
+        const char* end_ = nullptr;
+        std::string* error_ = nullptr;
+        JournalRecord record_{};
+    };
+
+    struct Records {
+        Iterator begin_iterator;
+        Iterator end_iterator;
+
+        Iterator begin() const {
+            return begin_iterator;
+        }
+
+        Iterator end() const {
+            return end_iterator;
+        }
+    };
+
+    static bool HasJournalHeader(std::string_view data) {
+        return data.size() >= sizeof(JournalHeader) && std::memcmp(data.data(), JournalHeader::kMagic, sizeof(JournalHeader::kMagic)) == 0;
+    }
+
+    static std::optional<JournalReader> Open(const std::string& path, std::string* error) {
+        std::optional<MappedFile> file = MappedFile::Open(path, error);
+        if (!file) {
+            return std::nullopt;
+        }
+        std::string_view data = file->data();
+        if (!HasJournalHeader(data)) {
+            *error = absl::StrFormat("%s is not an order journal", path);
+            return std::nullopt;
+        }
+        JournalHeader header;
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (header.version != JournalHeader::kVersion || header.record_size != sizeof(PackedJournalRecord)) {
+            *error = absl::StrFormat("%s has unsupported journal version %u with %u-byte records", path, header.version, header.record_size);
+            return std::nullopt;
+        }
+        if ((data.size() - sizeof(header)) % sizeof(PackedJournalRecord) != 0) {
+            *error = absl::StrFormat("%s ends with a truncated record", path);
+            return std::nullopt;
+        }
+        return JournalReader(path, std::move(*file));
+    }
+
+    // Iteration stops early at a damaged record and describes it in `error`,
+    // which is left alone otherwise.
+    Records records(std::string* error) const {
+        return records(0, record_count(), error);
+    }
+
+    // The `count` records from record `first` on, clamped to the journal.
+    Records records(uint64_t first, uint64_t count, std::string* error) const {
+        first = std::min(first, record_count());
+        count = std::min(count, record_count() - first);
+        const char* begin = first_record() + first * sizeof(PackedJournalRecord);
+        const char* end = begin + count * sizeof(PackedJournalRecord);
+        return Records{
+            .begin_iterator = Iterator(this, begin, end, error),
+            .end_iterator = Iterator(this, end, end, error),
+        };
+    }
+
+    uint64_t record_count() const {
+        return (file_.data().size() - sizeof(JournalHeader)) / sizeof(PackedJournalRecord);
+    }
+
+private:
+    JournalReader(std::string path, MappedFile file) : path_(std::move(path)), file_(std::move(file)) {
+    }
+
+    const char* first_record() const {
+        return file_.data().data() + sizeof(JournalHeader);
+    }
+
+    std::string path_;
+    MappedFile file_;
+};
+
+
+// Records the engine's trades into a journal. A journal missing a trade would
+// replay to a different book, so a trade the journal cannot hold, one with a
+// symbol above PackedJournalRecord::kMaxSymbol, is fatal.
+class JournalTradeSink : public TradeSink {
+public:
+    explicit JournalTradeSink(JournalWriter& writer) : writer_(writer) {
+    }
+
+    void OnTrade(const Trade& trade) override {
+        if (!writer_.Append(trade)) {
+            LOG(FATAL) << absl::StrFormat("Trade of orders %u and %u has symbol %u, above the journal's limit %u",
+                                          trade.buy_id, trade.sell_id, trade.symbol, PackedJournalRecord::kMaxSymbol);
+        }
+    }
+
+    void Flush() override {
+        writer_.Flush();
+    }
+
+private:
+    JournalWriter& writer_;
+};
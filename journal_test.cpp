@@ -0,0 +1,271 @@
+#include <gtest/gtest.h>
+#include "journal.h"
+#include "order_flow_generator.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+std::string TempPath(const std::string& name) {
+    return ::testing::TempDir() + "/" + name;
+}
+
+}  // namespace
+
+TEST(JournalTest, RoundTrip) {
+    std::string path = TempPath("journal_test_round_trip.journal");
+    std::vector<OrderRecord> orders = {
+        {.id = 1, .quantity = 100, .side = BUY_OS, .price = 99},
+        {.symbol = 7, .id = 2, .quantity = 500, .peak_size = 50, .type = ICEBERG_ORDER, .side = SELL_OS, .price = 101, .participant = 4},
+        {.id = 1, .action = OrderAction::kCancel},
+        {.id = 2, .quantity = 40, .price = 102, .action = OrderAction::kModify},
+    };
+    Trade trade{.symbol = 7, .buy_id = 3, .sell_id = 2, .price = 101, .quantity = 50};
+    {
+        std::string error;
+        std::optional<JournalWriter> writer = JournalWriter::Open(path, &error);
+        ASSERT_TRUE(writer) << error;
+        for (const OrderRecord& order : orders) {
+            writer->Append(order);
+        }
+        writer->Append(trade);
+        EXPECT_TRUE(writer->Flush());
+        EXPECT_EQ(writer->records(), 5);
+    }
+
+    std::string error;
+    std::optional<JournalReader> reader = JournalReader::Open(path, &error);
+    ASSERT_TRUE(reader) << error;
+    EXPECT_EQ(reader->record_count(), 5);
+    JournalReader::Records all = reader->records(&error);
+    std::vector<JournalRecord> records(all.begin(), all.end());
+    EXPECT_EQ(error, "");
+    ASSERT_EQ(records.size(), 5);
+    for (size_t i = 0; i < orders.size(); ++i) {
+        const JournalRecord& record = records[i];
+        ASSERT_TRUE(record.is_order());
+        OrderRecord order = record.ToOrder();
+        EXPECT_EQ(order.symbol, orders[i].symbol);
+        EXPECT_EQ(order.action, orders[i].action);
+        EXPECT_EQ(order.type, orders[i].type);
+        EXPECT_EQ(order.side, orders[i].side);
+        EXPECT_EQ(order.id, orders[i].id);
+        EXPECT_EQ(order.price, orders[i].price);
+        EXPECT_EQ(order.quantity, orders[i].quantity);
+        EXPECT_EQ(order.peak_size, orders[i].peak_size);
+        EXPECT_EQ(order.participant, orders[i].participant);
+    }
+    EXPECT_FALSE(records[4].is_order());
+    EXPECT_EQ(records[4].ToTrade().ToString(), trade.ToString());
+    std::remove(path.c_str());
+}
+
+TEST(JournalTest, ReadsAnyRunOfFixedWidthRecords) {
+    std::string path = TempPath("journal_test_runs.journal");
+    OrderFlowConfig config;
+    config.cancel_ratio = 0.2;
+    std::vector<OrderRecord> flow = OrderFlowGenerator(config).Generate(100000);
+    {
+        std::string error;
+        std::optional<JournalWriter> writer = JournalWriter::Open(path, &error);
+        ASSERT_TRUE(writer) << error;
+        for (const OrderRecord& order : flow) {
+            writer->Append(order);
+        }
+    }
+
+    std::string error;
+    std::optional<JournalReader> reader = JournalReader::Open(path, &error);
+    ASSERT_TRUE(reader) << error;
+    size_t journal_bytes = std::ifstream(path, std::ios::binary | std::ios::ate).tellg();
+    EXPECT_EQ(journal_bytes, sizeof(JournalHeader) + flow.size() * 20);
+    ASSERT_EQ(reader->record_count(), flow.size());
+    auto expect_run = [&](uint64_t first, uint64_t count) {
+        size_t i = std::min<uint64_t>(first, flow.size());
+        for (const JournalRecord& record : reader->records(first, count, &error)) {
+            OrderRecord order = record.ToOrder();
+            ASSERT_EQ(order.action, flow[i].action) << i;
+            ASSERT_EQ(order.id, flow[i].id) << i;
+            if (order.action != OrderAction::kCancel) {
+                ASSERT_EQ(order.side, flow[i].side) << i;
+                ASSERT_EQ(order.price, flow[i].price) << i;
+                ASSERT_EQ(order.quantity, flow[i].quantity) << i;
+            }
+            ++i;
+        }
+        EXPECT_EQ(i, std::min<uint64_t>(first + count, flow.size()));
+    };
+    expect_run(0, flow.size());
+    expect_run(31337, 1000);
+    expect_run(flow.size() - 10, 100);
+    expect_run(flow.size() + 1, 5);
+    std::remove(path.c_str());
+}
+
+TEST(JournalTest, RefusesFieldsBeyondThePackedWidth) {
+    std::string path = TempPath("journal_test_refused.journal");
+    std::string error;
+    {
+        std::optional<JournalWriter> writer = JournalWriter::Open(path, &error);
+        ASSERT_TRUE(writer) << error;
+        EXPECT_TRUE(writer->Append(OrderRecord{.symbol = PackedJournalRecord::kMaxSymbol, .id = 1, .participant = PackedJournalRecord::kMaxParticipant}));
+        EXPECT_FALSE(writer->Append(OrderRecord{.symbol = PackedJournalRecord::kMaxSymbol + 1, .id = 2}));
+        EXPECT_FALSE(writer->Append(OrderRecord{.id = 3, .participant = PackedJournalRecord::kMaxParticipant + 1}));
+        EXPECT_EQ(writer->records(), 1);
+        EXPECT_EQ(writer->refused(), 2);
+    }
+    std::optional<JournalReader> reader = JournalReader::Open(path, &error);
+    ASSERT_TRUE(reader) << error;
+    ASSERT_EQ(reader->record_count(), 1);
+    OrderRecord order = reader->records(&error).begin()->ToOrder();
+    EXPECT_EQ(order.symbol, PackedJournalRecord::kMaxSymbol);
+    EXPECT_EQ(order.participant, PackedJournalRecord::kMaxParticipant);
+    std::remove(path.c_str());
+}
+
+TEST(JournalTest, RejectsOtherVersions) {
+    std::string path = TempPath("journal_test_versions.journal");
+    for (uint32_t version : {JournalHeader::kVersion - 1, JournalHeader::kVersion + 1}) {
+        JournalHeader header{.version = version, .record_size = sizeof(PackedJournalRecord)};
+        std::memcpy(header.magic, JournalHeader::kMagic, sizeof(header.magic));
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::string error;
+        EXPECT_FALSE(JournalReader::Open(path, &error));
+        EXPECT_NE(error.find(absl::StrFormat("unsupported journal version %u", version)), std::string::npos) << error;
+    }
+
+    // The current version with a record size it does not have.
+    JournalHeader header{.version = JournalHeader::kVersion, .record_size = 28};
+    std::memcpy(header.magic, JournalHeader::kMagic, sizeof(header.magic));
+    std::ofstream(path, std::ios::binary | std::ios::trunc).write(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::string error;
+    EXPECT_FALSE(JournalReader::Open(path, &error));
+    EXPECT_NE(error.find("28-byte records"), std::string::npos) << error;
+    std::remove(path.c_str());
+}
+
+TEST(JournalTest, RejectsForeignFiles) {
+    std::string path = TempPath("journal_test_foreign.journal");
+    std::string error;
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << "B,1,2,3\n";
+    }
+    EXPECT_FALSE(JournalReader::Open(path, &error));
+    EXPECT_NE(error.find("not an order journal"), std::string::npos);
+
+    {
+        std::optional<JournalWriter> writer = JournalWriter::Open(path, &error);
+        writer->Append(OrderRecord{.id = 1});
+    }
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        out << "x";
+    }
+    EXPECT_FALSE(JournalReader::Open(path, &error));
+    EXPECT_NE(error.find("truncated"), std::string::npos);
+    std::remove(path.c_str());
+}
+
+TEST(JournalTest, StopsAtDamagedRecord) {
+    std::string path = TempPath("journal_test_damaged.journal");
+    std::string error;
+    {
+        std::optional<JournalWriter> writer = JournalWriter::Open(path, &error);
+        ASSERT_TRUE(writer) << error;
+        for (uint32_t id = 1; id <= 3; ++id) {
+            writer->Append(OrderRecord{.id = id, .quantity = 10, .price = 100});
+        }
+    }
+    {
+        // Gives the second record order type 7.
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(sizeof(JournalHeader) + sizeof(PackedJournalRecord) + offsetof(PackedJournalRecord, packed));
+        file.put(7 << 3);
+    }
+
+    std::optional<JournalReader> reader = JournalReader::Open(path, &error);
+    ASSERT_TRUE(reader) << error;
+    EXPECT_EQ(reader->record_count(), 3);
+    std::vector<uint32_t> ids;
+    for (const JournalRecord& record : reader->records(&error)) {
+        ids.push_back(record.id);
+    }
+    EXPECT_EQ(ids, std::vector<uint32_t>{1});
+    EXPECT_NE(error.find("damaged record 1"), std::string::npos) << error;
+
+    error.clear();
+    ids.clear();
+    for (const JournalRecord& record : reader->records(2, 1, &error)) {
+        ids.push_back(record.id);
+    }
+    EXPECT_EQ(ids, std::vector<uint32_t>{3});
+    EXPECT_EQ(error, "");
+    std::remove(path.c_str());
+}
+
+TEST(JournalDeathTest, TradeSinkDiesOnTradesTheJournalCannotHold) {
+    std::string path = TempPath("journal_test_trade_limit.journal");
+    std::string error;
+    std::optional<JournalWriter> writer = JournalWriter::Open(path, &error);
+    ASSERT_TRUE(writer) << error;
+    JournalTradeSink sink(*writer);
+    sink.OnTrade(Trade{.symbol = PackedJournalRecord::kMaxSymbol, .buy_id = 1, .sell_id = 2, .price = 100, .quantity = 5});
+    EXPECT_EQ(writer->records(), 1);
+    EXPECT_DEATH(sink.OnTrade(Trade{.symbol = PackedJournalRecord::kMaxSymbol + 1, .buy_id = 3, .sell_id = 4, .price = 100, .quantity = 5}),
+                 "above the journal's limit");
+    std::remove(path.c_str());
+}
+
+TEST(JournalTest, RecordsAndReplaysEngineSession) {
+    std::string path = TempPath("journal_test_session.journal");
+    std::vector<OrderRecord> orders = {
+        {.id = 1, .quantity = 20, .peak_size = 5, .type = ICEBERG_ORDER, .side = SELL_OS, .price = 100},
+        {.id = 2, .quantity = 5, .side = SELL_OS, .price = 100},
+        {.id = 3, .quantity = 30, .side = BUY_OS, .price = 100},
+    };
+    std::ostringstream direct_output;
+    {
+        std::string error;
+        std::optional<JournalWriter> writer = JournalWriter::Open(path, &error);
+        ASSERT_TRUE(writer) << error;
+        JournalTradeSink sink(*writer);
+        MatchingSystem system(OutputPolicy::TradesOnly(), &sink);
+        MatchingSystem reference(OutputPolicy::TradesOnly(direct_output));
+        for (const OrderRecord& order : orders) {
+            writer->Append(order);
+            system.Apply(order);
+            reference.Apply(order);
+        }
+    }
+
+    std::string error;
+    std::optional<JournalReader> reader = JournalReader::Open(path, &error);
+    ASSERT_TRUE(reader) << error;
+    std::ostringstream journal_trades;
+    std::ostringstream replay_output;
+    {
+        MatchingSystem replay(OutputPolicy::TradesOnly(replay_output));
+        for (const JournalRecord& record : reader->records(&error)) {
+            if (record.is_order()) {
+                replay.Apply(record.ToOrder());
+            } else {
+                journal_trades << record.ToTrade() << '\n';
+            }
+        }
+    }
+    EXPECT_EQ(journal_trades.str(), "3,1,100,20\n3,2,100,5\n");
+    EXPECT_EQ(replay_output.str(), direct_output.str());
+    std::remove(path.c_str());
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    ::testing::GTEST_FLAG(output) = "stdout";
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,158 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <glog/logging.h>
+#include "batch_parser.h"
+#include "homework.h"
+#include "journal.h"
+#include "mapped_file.h"
+
+// Converts between the text order format and the binary journal.
+//
+//   journal_tool to_journal <orders.csv> <orders.journal>
+//   journal_tool to_csv <orders.journal> <orders.csv>
+//
+// Trades have no text order form, so to_csv writes them as "# trade" comments.
+
+namespace {
+
+char* FormatOrderLine(const JournalRecord& record, char* out) {
+    auto field = [&out](uint64_t value) {
+        *out++ = ',';
+        out = FormatUnsigned(value, out);
+    };
+    if (record.symbol && record.kind != JournalRecordKind::kTrade) {
+        out = FormatUnsigned(record.symbol, out);
+        *out++ = ',';
+    }
+    switch (record.kind) {
+        case JournalRecordKind::kAddOrder:
+            *out++ = record.side == SELL_OS ? 'S' : 'B';
+            field(record.id);
+            field(record.price);
+            field(record.quantity);
+            if (record.type == ICEBERG_ORDER) {
+                field(record.auxiliary);
+            } else if (const char* type_name = ImmediateOrderTypeName(static_cast<OrderType>(record.type))) {
+                *out++ = ',';
+                out = std::copy_n(type_name, std::strlen(type_name), out);
+            }
+            if (record.participant) {
+                *out++ = ',';
+                *out++ = '@';
+                out = FormatUnsigned(record.participant, out);
+            }
+            break;
+        case JournalRecordKind::kCancelOrder:
+            *out++ = 'C';
+            field(record.id);
+            break;
+        case JournalRecordKind::kModifyOrder:
+            *out++ = 'M';
+            field(record.id);
+            field(record.price);
+            field(record.quantity);
+            break;
+        case JournalRecordKind::kTrade:
+            out = std::copy_n("# trade ", 8, out);
+            if (record.symbol) {
+                out = FormatUnsigned(record.symbol, out);
+                *out++ = ',';
+            }
+            out = FormatUnsigned(record.id, out);
+            field(record.auxiliary);
+            field(record.price);
+            field(record.quantity);
+            break;
+    }
+    *out++ = '\n';
+    return out;
+}
+
+int ToJournal(const std::string& input_path, const std::string& output_path) {
+    std::string error;
+    std::optional<MappedFile> input = MappedFile::Open(input_path, &error);
+    std::optional<JournalWriter> writer;
+    if (input) {
+        writer = JournalWriter::Open(output_path, &error);
+    }
+    if (!writer) {
+        std::cerr << error << '\n';
+        return 1;
+    }
+    BatchOrderParser parser(input->data());
+    std::vector<OrderRecord> batch(4096);
+    while (size_t count = parser.Next(batch)) {
+        for (size_t i = 0; i < count; ++i) {
+            if (!writer->Append(batch[i])) {
+                std::cerr << absl::StrFormat("%s: order %u has a symbol or participant too large for the journal\n", input_path, batch[i].id);
+            }
+        }
+    }
+    for (const ParseError& parse_error : parser.errors()) {
+        std::cerr << absl::StrFormat("%s:%u: %s\n", input_path, parse_error.line_number, parse_error.reason);
+    }
+    if (!writer->Flush()) {
+        std::cerr << "Cannot write " << output_path << '\n';
+        return 1;
+    }
+    std::cerr << absl::StrFormat("%u records written to %s\n", writer->records(), output_path);
+    return parser.errors().empty() && !writer->refused() ? 0 : 1;
+}
+
+int ToCsv(const std::string& input_path, const std::string& output_path) {
+    std::string error;
+    std::optional<JournalReader> reader = JournalReader::Open(input_path, &error);
+    if (!reader) {
+        std::cerr << error << '\n';
+        return 1;
+    }
+    std::ofstream output(output_path, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        std::cerr << "Cannot create " << output_path << '\n';
+        return 1;
+    }
+    constexpr size_t kMaxLineSize = 80;
+    std::vector<char> buffer(1 << 20);
+    char* out = buffer.data();
+    for (const JournalRecord& record : reader->records(&error)) {
+        if (buffer.data() + buffer.size() - out < static_cast<ptrdiff_t>(kMaxLineSize)) {
+            output.write(buffer.data(), out - buffer.data());
+            out = buffer.data();
+        }
+        out = FormatOrderLine(record, out);
+    }
+    output.write(buffer.data(), out - buffer.data());
+    output.flush();
+    if (!output) {
+        std::cerr << "Cannot write " << output_path << '\n';
+        return 1;
+    }
+    if (!error.empty()) {
+        std::cerr << error << '\n';
+        return 1;
+    }
+    return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    google::InitGoogleLogging(argv[0]);
+
+    if (argc != 4) {
+        std::cerr << "Usage: " << argv[0] << " to_journal|to_csv <input> <output>\n";
+        return 2;
+    }
+    std::string_view command(argv[1]);
+    if (command == "to_journal") {
+        return ToJournal(argv[2], argv[3]);
+    } else if (command == "to_csv") {
+        return ToCsv(argv[2], argv[3]);
+    }
+    std::cerr << "Unknown command " << command << '\n';
+    return 2;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "absl/strings/str_format.h"
+
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    static std::optional<MappedFile> Open(const std::string& path, std::string* error) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            *error = absl::StrFormat("Cannot open %s: %s", path, std::strerror(errno));
+            return std::nullopt;
+        }
+        struct stat status;
+        if (::fstat(fd, &status) != 0) {
+            *error = absl::StrFormat("Cannot stat %s: %s", path, std::strerror(errno));
+            ::close(fd);
+            return std::nullopt;
+        }
+        MappedFile file;
+        file.size_ = static_cast<size_t>(status.st_size);
+        if (file.size_ != 0) {
+            void* data = ::mmap(nullptr, file.size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                *error = absl::StrFormat("Cannot map %s: %s", path, std::strerror(errno));
+                ::close(fd);
+                return std::nullopt;
+            }
+            ::madvise(data, file.size_, MADV_SEQUENTIAL);
+            file.data_ = static_cast<const char*>(data);
+        }
+        ::close(fd);
+        return file;
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    ~MappedFile() {
+        if (data_) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    std::string_view data() const {
+        return std::string_view(data_, size_);
+    }
+
+private:
+    MappedFile() = default;
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
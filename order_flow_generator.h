@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <span>
+#include <vector>
+#include "homework.h"
+
+
+struct OrderFlowConfig {
+    // How far from the top of book passive orders are placed.
+    enum class PriceModel {
+        kUniform,     // Evenly over the whole depth.
+        kGeometric,   // Each level deeper is `geometric_continue` times as likely.
+        kHalfNormal,  // Bell-shaped around the top of book (Irwin-Hall approximation).
+    };
+
+    uint64_t seed = 1;
+    uint16_t mid_price = 10000;
+    uint16_t book_depth = 50;          // Price levels per side that passive orders use.
+    PriceModel price_model = PriceModel::kGeometric;
+    double geometric_continue = 0.8;
+    double aggressive_ratio = 0.2;     // Orders priced into the opposite side's passive levels.
+    double iceberg_ratio = 0.1;
+    double cancel_ratio = 0.0;         // Cancels of a random earlier passive order.
+    uint32_t min_quantity = 1;
+    uint32_t max_quantity = 1000;
+    uint32_t min_peak_size = 10;
+    uint32_t max_peak_size = 500;
+    uint32_t iceberg_volume_multiplier = 10;  // Iceberg total volume relative to a limit order.
+};
+
+// Deterministic synthetic order flow. Only the raw output of std::mt19937_64,
+// whose sequence the standard fixes, is used, so a seed yields the same flow
+// with every standard library.
+class OrderFlowGenerator {
+public:
+    explicit OrderFlowGenerator(const OrderFlowConfig& config) : config_(config), random_(config.seed) {
+        geometric_threshold_ = ToThreshold(config_.geometric_continue);
+        aggressive_threshold_ = ToThreshold(config_.aggressive_ratio);
+        iceberg_threshold_ = ToThreshold(config_.iceberg_ratio);
+        cancel_threshold_ = ToThreshold(config_.cancel_ratio);
+    }
+
+    OrderRecord Next() {
+        if (cancel_threshold_ && random_() < cancel_threshold_ && !passive_ids_.empty()) {
+            size_t index = Uniform(passive_ids_.size());
+            OrderRecord cancel{.id = passive_ids_[index], .action = OrderAction::kCancel};
+            passive_ids_[index] = passive_ids_.back();
+            passive_ids_.pop_back();
+            return cancel;
+        }
+
+        OrderRecord record{.id = next_id_++, .side = (random_() & 1) ? BUY_OS : SELL_OS};
+        bool aggressive = random_() < aggressive_threshold_;
+        int32_t offset = static_cast<int32_t>(PriceOffset());
+        bool above_mid = (record.side == BUY_OS) == aggressive;
+        int32_t price = config_.mid_price + (above_mid ? 1 + offset : -1 - offset);
+        record.price = static_cast<uint16_t>(std::clamp<int32_t>(price, 1, std::numeric_limits<uint16_t>::max() - 1));
+        record.quantity = UniformBetween(config_.min_quantity, config_.max_quantity);
+        if (random_() < iceberg_threshold_) {
+            record.type = ICEBERG_ORDER;
+            record.quantity *= config_.iceberg_volume_multiplier;
+            record.peak_size = UniformBetween(config_.min_peak_size, config_.max_peak_size);
+        }
+        if (!aggressive && cancel_threshold_) {
+            if (passive_ids_.size() < kMaxTrackedIds) {
+                passive_ids_.push_back(record.id);
+            } else {
+                passive_ids_[Uniform(passive_ids_.size())] = record.id;
+            }
+        }
+        return record;
+    }
+
+    void Generate(std::span<OrderRecord> records) {
+        for (OrderRecord& record : records) {
+            record = Next();
+        }
+    }
+
+    std::vector<OrderRecord> Generate(size_t count) {
+        std::vector<OrderRecord> records(count);
+        Generate(records);
+        return records;
+    }
+
+private:
+    static constexpr size_t kMaxTrackedIds = 1 << 16;
+
+    static uint64_t ToThreshold(double probability) {
+        if (probability <= 0) {
+            return 0;
+        }
+        if (probability >= 1) {
+            return std::numeric_limits<uint64_t>::max();
+        }
+        return static_cast<uint64_t>(probability * 18446744073709551616.0);
+    }
+
+    // Uniform in [0, bound) by multiply-shift.
+    uint64_t Uniform(uint64_t bound) {
+        return static_cast<uint64_t>((static_cast<unsigned __int128>(random_()) * bound) >> 64);
+    }
+
+    uint32_t UniformBetween(uint32_t low, uint32_t high) {
+        return low + static_cast<uint32_t>(Uniform(uint64_t{high} - low + 1));
+    }
+
+    uint32_t PriceOffset() {
+        uint32_t depth = std::max<uint32_t>(config_.book_depth, 1);
+        switch (config_.price_model) {
+            case OrderFlowConfig::PriceModel::kUniform:
+                return static_cast<uint32_t>(Uniform(depth));
+            case OrderFlowConfig::PriceModel::kGeometric: {
+                uint32_t offset = 0;
+                while (offset + 1 < depth && random_() < geometric_threshold_) {
+                    ++offset;
+                }
+                return offset;
+            }
+            case OrderFlowConfig::PriceModel::kHalfNormal: {
+                int64_t sum = 0;
+                for (int i = 0; i < 4; ++i) {
+                    sum += static_cast<int64_t>(Uniform(depth)) - static_cast<int64_t>(Uniform(depth));
+                }
+                return static_cast<uint32_t>(std::min<int64_t>(std::abs(sum) / 2, depth - 1));
+            }
+        }
+        return 0;
+    }
+
+    OrderFlowConfig config_;
+    std::mt19937_64 random_;
+    uint64_t geometric_threshold_;
+    uint64_t aggressive_threshold_;
+    uint64_t iceberg_threshold_;
+    uint64_t cancel_threshold_;
+    uint32_t next_id_ = 0;
+    std::vector<uint32_t> passive_ids_;
+};
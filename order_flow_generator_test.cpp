@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include "order_flow_generator.h"
+
+TEST(OrderFlowGeneratorTest, SameSeedSameFlow) {
+    OrderFlowConfig config;
+    config.cancel_ratio = 0.3;
+    std::vector<OrderRecord> first = OrderFlowGenerator(config).Generate(10000);
+    std::vector<OrderRecord> second = OrderFlowGenerator(config).Generate(10000);
+    for (size_t i = 0; i < first.size(); ++i) {
+        EXPECT_EQ(first[i].action, second[i].action);
+        EXPECT_EQ(first[i].id, second[i].id);
+        EXPECT_EQ(first[i].price, second[i].price);
+        EXPECT_EQ(first[i].quantity, second[i].quantity);
+    }
+    config.seed = 2;
+    std::vector<OrderRecord> other = OrderFlowGenerator(config).Generate(10000);
+    size_t differences = 0;
+    for (size_t i = 0; i < first.size(); ++i) {
+        differences += first[i].price != other[i].price;
+    }
+    EXPECT_GT(differences, 0);
+}
+
+TEST(OrderFlowGeneratorTest, RespectsMix) {
+    for (auto price_model : {OrderFlowConfig::PriceModel::kUniform, OrderFlowConfig::PriceModel::kGeometric, OrderFlowConfig::PriceModel::kHalfNormal}) {
+        OrderFlowConfig config;
+        config.price_model = price_model;
+        config.mid_price = 1000;
+        config.book_depth = 20;
+        config.aggressive_ratio = 0.25;
+        config.iceberg_ratio = 0.5;
+        config.cancel_ratio = 0.1;
+        size_t aggressive = 0;
+        size_t icebergs = 0;
+        size_t cancels = 0;
+        constexpr size_t kCount = 100000;
+        for (const OrderRecord& record : OrderFlowGenerator(config).Generate(kCount)) {
+            if (record.action == OrderAction::kCancel) {
+                ++cancels;
+                continue;
+            }
+            bool crosses = record.side == BUY_OS ? record.price > 1000 : record.price < 1000;
+            aggressive += crosses;
+            EXPECT_GE(record.price, 1000 - 20);
+            EXPECT_LE(record.price, 1000 + 20);
+            EXPECT_GE(record.quantity, config.min_quantity);
+            if (record.type == ICEBERG_ORDER) {
+                ++icebergs;
+                EXPECT_GE(record.peak_size, config.min_peak_size);
+                EXPECT_LE(record.peak_size, config.max_peak_size);
+            }
+        }
+        EXPECT_NEAR(cancels / static_cast<double>(kCount), 0.1, 0.01);
+        EXPECT_NEAR(aggressive / static_cast<double>(kCount - cancels), 0.25, 0.01);
+        EXPECT_NEAR(icebergs / static_cast<double>(kCount - cancels), 0.5, 0.01);
+    }
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    ::testing::GTEST_FLAG(output) = "stdout";
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "batch_parser.h"
+#include "homework.h"
+#include "spsc_queue.h"
+
+
+struct PipelineConfig {
+    size_t queue_capacity = 1 << 16;
+    WaitPolicy wait_policy = WaitPolicy::kAdaptive;
+    // CPUs the parse, match and output threads are pinned to; -1 leaves a thread unpinned.
+    int parse_cpu = -1;
+    int match_cpu = -1;
+    int output_cpu = -1;
+    SelfTradePrevention self_trade_prevention = SelfTradePrevention::kNone;
+    // Preallocates the engine and enforces the limits when set.
+    std::optional<EngineCapacity> capacity;
+};
+
+struct StageStats {
+    uint64_t items = 0;              // Records or trades the stage handled.
+    uint64_t full_queue_waits = 0;   // Backpressure: polls of a full downstream queue.
+    uint64_t empty_queue_waits = 0;  // Starvation: polls of an empty upstream queue.
+};
+
+struct PipelineStats {
+    StageStats parse;
+    StageStats match;
+    StageStats output;
+    uint64_t rejected = 0;
+    std::vector<ParseError> parse_errors;
+};
+
+// Runs the text order format through three stages, each on its own thread:
+// parsing, matching and trade formatting. Adjacent stages are connected by
+// bounded SpscQueues, so only the match thread ever touches the book and the
+// I/O-bound stages overlap with matching instead of adding to it.
+class OrderPipeline {
+public:
+    explicit OrderPipeline(const PipelineConfig& config = {})
+        : config_(config), records_(config.queue_capacity), trades_(config.queue_capacity),
+          trade_sink_(trades_, config.wait_policy), system_(OutputPolicy::TradesOnly(), &trade_sink_) {
+        system_.SetSelfTradePrevention(config.self_trade_prevention);
+        if (config.capacity) {
+            system_.Preallocate(*config.capacity);
+        }
+    }
+
+    OrderPipeline(const OrderPipeline&) = delete;
+    OrderPipeline& operator=(const OrderPipeline&) = delete;
+
+    // Applies every order in `input` and writes the trades to `out` as CSV
+    // lines. Blocks until all three stages are done.
+    PipelineStats Run(std::string_view input, std::ostream& out) {
+        PipelineStats stats;
+        std::atomic<bool> parse_done{false};
+        std::atomic<bool> match_done{false};
+        uint64_t full_queue_spins = trade_sink_.full_queue_spins();
+
+        // Each stage counts into locals and publishes them when it ends, so the
+        // threads do not share the cache lines of `stats` while running.
+        std::thread parse_thread([&] {
+            PinCurrentThread(config_.parse_cpu);
+            BatchOrderParser parser(input);
+            Backoff backoff(config_.wait_policy);
+            StageStats parse;
+            std::vector<OrderRecord> batch(kParseBatchSize);
+            while (size_t count = parser.Next(batch)) {
+                for (size_t i = 0; i < count; ++i) {
+                    while (!records_.TryPush(batch[i])) {
+                        ++parse.full_queue_waits;
+                        backoff.Wait();
+                    }
+                    backoff.Reset();
+                }
+                parse.items += count;
+            }
+            stats.parse = parse;
+            stats.parse_errors = parser.errors();
+            parse_done.store(true, std::memory_order_release);
+        });
+
+        std::thread match_thread([&] {
+            PinCurrentThread(config_.match_cpu);
+            Backoff backoff(config_.wait_policy);
+            StageStats match;
+            uint64_t rejected = 0;
+            OrderRecord record;
+            while (true) {
+                // Read before polling: once it is set, an empty queue stays empty.
+                bool upstream_done = parse_done.load(std::memory_order_acquire);
+                if (records_.TryPop(record)) {
+                    backoff.Reset();
+                    rejected += !system_.Apply(record);
+                    ++match.items;
+                    continue;
+                }
+                if (upstream_done) {
+                    break;
+                }
+                ++match.empty_queue_waits;
+                backoff.Wait();
+            }
+            match.full_queue_waits = trade_sink_.full_queue_spins() - full_queue_spins;
+            stats.match = match;
+            stats.rejected = rejected;
+            match_done.store(true, std::memory_order_release);
+        });
+
+        std::thread output_thread([&] {
+            PinCurrentThread(config_.output_cpu);
+            CsvTradeWriter writer(out);
+            Backoff backoff(config_.wait_policy);
+            StageStats output;
+            Trade trade;
+            while (true) {
+                bool upstream_done = match_done.load(std::memory_order_acquire);
+                if (trades_.TryPop(trade)) {
+                    backoff.Reset();
+                    writer.OnTrade(trade);
+                    ++output.items;
+                    continue;
+                }
+                if (upstream_done) {
+                    break;
+                }
+                ++output.empty_queue_waits;
+                backoff.Wait();
+            }
+            writer.Flush();
+            stats.output = output;
+        });
+
+        parse_thread.join();
+        match_thread.join();
+        output_thread.join();
+        return stats;
+    }
+
+    // Only valid while Run() is not executing.
+    const MatchingSystem& system() const {
+        return system_;
+    }
+
+private:
+    static constexpr size_t kParseBatchSize = 256;
+
+    static void PinCurrentThread(int cpu) {
+        if (cpu < 0) {
+            return;
+        }
+#if defined(__linux__)
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+            LOG(WARNING) << "Cannot pin a pipeline thread to CPU " << cpu << ": error " << error;
+        }
+#else
+        LOG(WARNING) << "Pinning pipeline threads is only supported on Linux";
+#endif
+    }
+
+    PipelineConfig config_;
+    SpscQueue<OrderRecord> records_;
+    SpscQueue<Trade> trades_;
+    QueueTradeSink trade_sink_;
+    MatchingSystem system_;
+};
@@ -0,0 +1,350 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <glog/logging.h>
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "batch_parser.h"
+#include "checkpoint.h"
+#include "homework.h"
+#include "journal.h"
+#include "mapped_file.h"
+#include "order_pipeline.h"
+#include "snapshot_renderer.h"
+
+// Replays an order file, either text or a binary journal, through MatchingSystem.
+// --restore starts from a checkpoint and skips the records it already covers;
+// --checkpoint saves the final book. --stats prints the engine counters to
+// stderr at the end and, given an interval, every that many events.
+// --pipeline parses, matches and writes trades on three threads, optionally
+// pinned to the given CPUs; it needs text input and trades-only output and
+// does not combine with --restore or a --stats interval. --stp sets the
+// self-trade prevention mode for orders with a participant. --preallocate
+// sizes the engine for that many resting orders and participant ids up to
+// the given one (0 by default) at startup and rejects orders beyond them.
+// --view writes a view of the book to a file every that many events, and
+// after the last one, from a separate render thread; views the renderer
+// cannot keep up with are skipped. Views show at most --view-levels levels
+// per side, all of them by default.
+//
+//   order_replay <orders.csv|orders.journal> [--output=trades|full|top=<levels>|every=<events>]
+//                [--restore=<checkpoint>] [--checkpoint=<checkpoint>] [--stats[=<events>]]
+//                [--pipeline[=<parse_cpu>,<match_cpu>,<output_cpu>]]
+//                [--stp=cancel-newest|cancel-oldest|decrement-both]
+//                [--preallocate=<max_orders>[,<max_participant>]]
+//                [--view=<path>,<events>[,table|json|csv]] [--view-levels=<levels>]
+
+namespace {
+
+constexpr size_t kBatchSize = 4096;
+
+std::optional<PipelineConfig> ParsePipelineFlag(std::string_view value) {
+    PipelineConfig config;
+    if (value.empty()) {
+        return config;
+    }
+    std::vector<std::string> cpus = absl::StrSplit(value, ',');
+    if (cpus.size() != 3 || !absl::SimpleAtoi(cpus[0], &config.parse_cpu) || !absl::SimpleAtoi(cpus[1], &config.match_cpu) ||
+        !absl::SimpleAtoi(cpus[2], &config.output_cpu)) {
+        return std::nullopt;
+    }
+    return config;
+}
+
+std::optional<OutputPolicy> ParseOutputFlag(std::string_view value) {
+    uint32_t number;
+    if (value == "trades") {
+        return OutputPolicy::TradesOnly();
+    } else if (value == "full") {
+        return OutputPolicy::FullSnapshot();
+    } else if (value.starts_with("top=") && absl::SimpleAtoi(value.substr(4), &number)) {
+        return OutputPolicy::TopLevels(number);
+    } else if (value.starts_with("every=") && absl::SimpleAtoi(value.substr(6), &number) && number > 0) {
+        return OutputPolicy::PeriodicSnapshot(number);
+    }
+    return std::nullopt;
+}
+
+std::optional<EngineCapacity> ParsePreallocateFlag(std::string_view value) {
+    EngineCapacity capacity;
+    std::vector<std::string> limits = absl::StrSplit(value, ',');
+    if (limits.size() > 2 || !absl::SimpleAtoi(limits[0], &capacity.max_resting_orders) ||
+        (limits.size() == 2 && (!absl::SimpleAtoi(limits[1], &capacity.max_participant) || capacity.max_participant > MatchingSystem::kMaxParticipant))) {
+        return std::nullopt;
+    }
+    return capacity;
+}
+
+struct ViewConfig {
+    std::string path;
+    uint32_t interval = 0;
+    SnapshotFormat format = SnapshotFormat::kTable;
+};
+
+std::optional<ViewConfig> ParseViewFlag(std::string_view value) {
+    ViewConfig view;
+    std::vector<std::string> fields = absl::StrSplit(value, ',');
+    if (fields.size() < 2 || fields.size() > 3 || fields[0].empty() || !absl::SimpleAtoi(fields[1], &view.interval) || view.interval == 0) {
+        return std::nullopt;
+    }
+    view.path = fields[0];
+    if (fields.size() == 3) {
+        if (fields[2] == "json") {
+            view.format = SnapshotFormat::kDepthJson;
+        } else if (fields[2] == "csv") {
+            view.format = SnapshotFormat::kDepthCsv;
+        } else if (fields[2] != "table") {
+            return std::nullopt;
+        }
+    }
+    return view;
+}
+
+std::optional<SelfTradePrevention> ParseStpFlag(std::string_view value) {
+    if (value == "cancel-newest") {
+        return SelfTradePrevention::kCancelNewest;
+    } else if (value == "cancel-oldest") {
+        return SelfTradePrevention::kCancelOldest;
+    } else if (value == "decrement-both") {
+        return SelfTradePrevention::kDecrementBoth;
+    }
+    return std::nullopt;
+}
+
+void PrintStageStats(const char* stage, const StageStats& stats) {
+    std::cerr << absl::StrFormat("  %-6s %u items, %u full queue waits, %u empty queue waits\n", stage, stats.items,
+                                 stats.full_queue_waits, stats.empty_queue_waits);
+}
+
+int RunPipeline(const std::string& path, std::string_view input, const PipelineConfig& config, const std::string& checkpoint_path,
+                bool print_stats) {
+    auto start = std::chrono::steady_clock::now();
+    OrderPipeline pipeline(config);
+    PipelineStats stats = pipeline.Run(input, std::cout);
+    std::cout.flush();
+    std::string error;
+    if (!checkpoint_path.empty() &&
+        !Checkpoint::Capture(pipeline.system().order_book(), stats.match.items).Write(checkpoint_path, &error)) {
+        std::cerr << error << '\n';
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (const ParseError& parse_error : stats.parse_errors) {
+        std::cerr << absl::StrFormat("%s:%u: %s\n", path, parse_error.line_number, parse_error.reason);
+    }
+    std::cerr << absl::StrFormat("%u records (%u rejected), %u malformed lines in %.3fs: %.0f records/s\n", stats.match.items,
+                                 stats.rejected, stats.parse_errors.size(), seconds, stats.match.items / std::max(seconds, 1e-9));
+    if (print_stats) {
+        PrintStageStats("parse", stats.parse);
+        PrintStageStats("match", stats.match);
+        PrintStageStats("output", stats.output);
+        std::cerr << pipeline.system().stats().ToString() << '\n';
+        std::cerr << pipeline.system().memory_stats().ToString() << '\n';
+    }
+    return stats.parse_errors.empty() ? 0 : 1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    google::InitGoogleLogging(argv[0]);
+
+    std::string path;
+    std::string restore_path;
+    std::string checkpoint_path;
+    std::optional<OutputPolicy> output_policy = OutputPolicy::TradesOnly();
+    bool print_stats = false;
+    uint32_t stats_interval = 0;
+    std::optional<PipelineConfig> pipeline_config;
+    std::optional<SelfTradePrevention> self_trade_prevention = SelfTradePrevention::kNone;
+    std::optional<EngineCapacity> capacity;
+    std::optional<ViewConfig> view_config;
+    size_t view_levels = PriceLevelBitmap::kLevels;
+    bool valid_flags = true;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view argument(argv[i]);
+        if (argument.starts_with("--output=")) {
+            output_policy = ParseOutputFlag(argument.substr(9));
+        } else if (argument.starts_with("--restore=")) {
+            restore_path = argument.substr(10);
+        } else if (argument.starts_with("--checkpoint=")) {
+            checkpoint_path = argument.substr(13);
+        } else if (argument == "--pipeline" || argument.starts_with("--pipeline=")) {
+            pipeline_config = ParsePipelineFlag(argument.substr(std::min<size_t>(argument.size(), 11)));
+            valid_flags &= pipeline_config.has_value();
+        } else if (argument.starts_with("--stp=")) {
+            self_trade_prevention = ParseStpFlag(argument.substr(6));
+            valid_flags &= self_trade_prevention.has_value();
+        } else if (argument.starts_with("--preallocate=")) {
+            capacity = ParsePreallocateFlag(argument.substr(14));
+            valid_flags &= capacity.has_value();
+        } else if (argument.starts_with("--view=")) {
+            view_config = ParseViewFlag(argument.substr(7));
+            valid_flags &= view_config.has_value();
+        } else if (argument.starts_with("--view-levels=")) {
+            valid_flags &= absl::SimpleAtoi(argument.substr(14), &view_levels);
+        } else if (argument == "--stats") {
+            print_stats = true;
+        } else if (argument.starts_with("--stats=")) {
+            print_stats = true;
+            valid_flags &= absl::SimpleAtoi(argument.substr(8), &stats_interval) && stats_interval > 0;
+        } else if (path.empty()) {
+            path = argument;
+        } else {
+            valid_flags = false;
+        }
+    }
+    if (pipeline_config && (!output_policy || output_policy->mode != OutputPolicy::Mode::kTradesOnly || !restore_path.empty() || stats_interval || view_config)) {
+        valid_flags = false;
+    }
+    if (path.empty() || !output_policy || !valid_flags) {
+        std::cerr << "Usage: " << argv[0] << " <orders.csv|orders.journal> [--output=trades|full|top=<levels>|every=<events>]"
+                  << " [--restore=<checkpoint>] [--checkpoint=<checkpoint>] [--stats[=<events>]]"
+                  << " [--pipeline[=<parse_cpu>,<match_cpu>,<output_cpu>]]"
+                  << " [--stp=cancel-newest|cancel-oldest|decrement-both]"
+                  << " [--preallocate=<max_orders>[,<max_participant>]]"
+                  << " [--view=<path>,<events>[,table|json|csv]] [--view-levels=<levels>]\n";
+        return 2;
+    }
+    output_policy->stats_interval = stats_interval;
+
+    std::string error;
+    std::optional<MappedFile> file = MappedFile::Open(path, &error);
+    std::optional<JournalReader> journal;
+    if (file && JournalReader::HasJournalHeader(file->data())) {
+        file.reset();
+        journal = JournalReader::Open(path, &error);
+    }
+    if (!file && !journal) {
+        std::cerr << error << '\n';
+        return 1;
+    }
+
+    std::ios::sync_with_stdio(false);
+    if (pipeline_config) {
+        if (!file) {
+            std::cerr << "--pipeline needs a text order file\n";
+            return 2;
+        }
+        pipeline_config->self_trade_prevention = *self_trade_prevention;
+        pipeline_config->capacity = capacity;
+        return RunPipeline(path, file->data(), *pipeline_config, checkpoint_path, print_stats);
+    }
+    MatchingSystem system(*output_policy);
+    system.SetSelfTradePrevention(*self_trade_prevention);
+    // Records covered by the restored checkpoint.
+    uint64_t skip = 0;
+    if (!restore_path.empty()) {
+        std::optional<Checkpoint> checkpoint = Checkpoint::Read(restore_path, &error);
+        if (!checkpoint) {
+            std::cerr << error << '\n';
+            return 1;
+        }
+        checkpoint->RestoreInto(system);
+        skip = checkpoint->sequence();
+    }
+    if (capacity) {
+        system.Preallocate(*capacity);
+    }
+    std::ofstream view_file;
+    std::optional<SnapshotRenderer> view;
+    if (view_config) {
+        view_file.open(view_config->path, std::ios::trunc);
+        if (!view_file) {
+            std::cerr << "Cannot create " << view_config->path << '\n';
+            return 1;
+        }
+        view.emplace(view_file, view_config->format, view_levels);
+    }
+    uint64_t sequence = skip;
+    uint64_t records = 0;
+    uint64_t rejected = 0;
+    size_t malformed_lines = 0;
+    // Snapshot modes print after every record, so only trades-only output is batched.
+    bool batched = output_policy->mode == OutputPolicy::Mode::kTradesOnly;
+    std::vector<OrderResult> results(kBatchSize);
+
+    auto start = std::chrono::steady_clock::now();
+    std::string journal_error;
+    if (journal) {
+        for (const JournalRecord& record : journal->records(&journal_error)) {
+            if (record.is_order()) {
+                if (skip) {
+                    --skip;
+                    continue;
+                }
+                rejected += !system.Apply(record.ToOrder());
+                ++records;
+                if (view && records % view_config->interval == 0) {
+                    view->Publish(system.order_book(), sequence + records);
+                }
+            }
+        }
+    } else {
+        BatchOrderParser parser(file->data());
+        std::vector<OrderRecord> batch(kBatchSize);
+        while (size_t count = parser.Next(batch)) {
+            std::span<const OrderRecord> tail(batch.data(), count);
+            size_t skipped = std::min<uint64_t>(skip, count);
+            skip -= skipped;
+            tail = tail.subspan(skipped);
+            while (!tail.empty()) {
+                // Ends at the next view, if there is one in this batch.
+                size_t chunk_size = tail.size();
+                if (view) {
+                    chunk_size = std::min<size_t>(chunk_size, view_config->interval - records % view_config->interval);
+                }
+                std::span<const OrderRecord> chunk = tail.first(chunk_size);
+                if (batched) {
+                    system.AddOrders(chunk, results);
+                    for (size_t i = 0; i < chunk.size(); ++i) {
+                        rejected += !results[i].accepted();
+                    }
+                } else {
+                    for (const OrderRecord& record : chunk) {
+                        rejected += !system.Apply(record);
+                    }
+                }
+                records += chunk.size();
+                tail = tail.subspan(chunk_size);
+                if (view && records % view_config->interval == 0) {
+                    view->Publish(system.order_book(), sequence + records);
+                }
+            }
+        }
+        for (const ParseError& parse_error : parser.errors()) {
+            std::cerr << absl::StrFormat("%s:%u: %s\n", path, parse_error.line_number, parse_error.reason);
+        }
+        malformed_lines = parser.errors().size();
+    }
+    system.Flush();
+    std::cout.flush();
+    if (!journal_error.empty()) {
+        std::cerr << journal_error << '\n';
+        return 1;
+    }
+    if (view && records % view_config->interval != 0) {
+        view->Publish(system.order_book(), sequence + records);
+    }
+    view.reset();
+    sequence += records;
+    if (!checkpoint_path.empty() && !Checkpoint::Capture(system.order_book(), sequence).Write(checkpoint_path, &error)) {
+        std::cerr << error << '\n';
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << absl::StrFormat("%u records (%u rejected), %u malformed lines in %.3fs: %.0f records/s\n",
+                                 records, rejected, malformed_lines, seconds, records / std::max(seconds, 1e-9));
+    if (print_stats) {
+        std::cerr << system.stats().ToString() << '\n';
+        std::cerr << system.memory_stats().ToString() << '\n';
+    }
+    return malformed_lines == 0 ? 0 : 1;
+}
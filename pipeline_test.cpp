@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include "order_flow_generator.h"
+#include "order_pipeline.h"
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+namespace {
+
+std::string FlowText(const std::vector<OrderRecord>& flow) {
+    std::string text;
+    for (const OrderRecord& record : flow) {
+        if (record.action == OrderAction::kCancel) {
+            text += absl::StrFormat("C,%u\n", record.id);
+        } else if (record.type == ICEBERG_ORDER) {
+            text += absl::StrFormat("%c,%u,%hu,%u,%u\n", record.side == BUY_OS ? 'B' : 'S', record.id, record.price, record.quantity, record.peak_size);
+        } else {
+            text += absl::StrFormat("%c,%u,%hu,%u\n", record.side == BUY_OS ? 'B' : 'S', record.id, record.price, record.quantity);
+        }
+    }
+    return text;
+}
+
+}  // namespace
+
+TEST(OrderPipelineTest, MatchesSingleThreadedRun) {
+    OrderFlowConfig config;
+    config.iceberg_ratio = 0.2;
+    config.cancel_ratio = 0.1;
+    std::vector<OrderRecord> flow = OrderFlowGenerator(config).Generate(50000);
+    std::string text = FlowText(flow) + "X,1,2,3\n";
+
+    std::ostringstream expected_out;
+    size_t expected_resting;
+    {
+        MatchingSystem system(OutputPolicy::TradesOnly(expected_out));
+        for (const OrderRecord& record : flow) {
+            system.Apply(record);
+        }
+        expected_resting = system.order_book().size();
+    }
+    std::string expected = expected_out.str();
+
+    // Tiny queues force every stage to wait on its neighbours. Busy spinning
+    // only makes progress when the threads have cores of their own, so it gets
+    // larger queues to stay fast on small test machines.
+    for (PipelineConfig config : {PipelineConfig{.queue_capacity = 8, .wait_policy = WaitPolicy::kAdaptive},
+                                  PipelineConfig{.queue_capacity = 4096, .wait_policy = WaitPolicy::kBusySpin}}) {
+        OrderPipeline pipeline(config);
+        std::ostringstream out;
+        PipelineStats stats = pipeline.Run(text, out);
+        EXPECT_EQ(out.str(), expected);
+        EXPECT_EQ(stats.parse.items, flow.size());
+        EXPECT_EQ(stats.match.items, flow.size());
+        EXPECT_EQ(stats.output.items, std::count(expected.begin(), expected.end(), '\n'));
+        ASSERT_EQ(stats.parse_errors.size(), 1);
+        EXPECT_EQ(stats.parse_errors[0].line_number, flow.size() + 1);
+        EXPECT_EQ(pipeline.system().order_book().size(), expected_resting);
+    }
+}
+
+TEST(OrderPipelineTest, EmptyInput) {
+    OrderPipeline pipeline({.parse_cpu = 0, .match_cpu = 0, .output_cpu = 0});
+    std::ostringstream out;
+    PipelineStats stats = pipeline.Run("", out);
+    EXPECT_EQ(out.str(), "");
+    EXPECT_EQ(stats.match.items, 0);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    ::testing::GTEST_FLAG(output) = "stdout";
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,187 @@
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <glog/logging.h>
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "batch_parser.h"
+#include "homework.h"
+#include "journal.h"
+#include "mapped_file.h"
+#include "order_flow_generator.h"
+#include "replay_digest.h"
+
+// Replays an order file or a generated flow and records or verifies a golden
+// file of per-event output digests, so changes to the book can be checked
+// against millions of events. Verification stops at the first event whose
+// trades or book state differ from the golden run and prints it.
+//
+//   replay_check <orders.csv|orders.journal|--generate=<count>> [--seed=<seed>] --record=<golden>
+//   replay_check <orders.csv|orders.journal|--generate=<count>> [--seed=<seed>] --verify=<golden>
+
+namespace {
+
+constexpr size_t kBatchSize = 4096;
+
+std::string DescribeRecord(const OrderRecord& record) {
+    std::string symbol = record.symbol ? absl::StrFormat("%u,", record.symbol) : "";
+    switch (record.action) {
+        case OrderAction::kCancel:
+            return absl::StrFormat("%sC,%u", symbol, record.id);
+        case OrderAction::kModify:
+            return absl::StrFormat("%sM,%u,%hu,%u", symbol, record.id, record.price, record.quantity);
+        case OrderAction::kAdd:
+            break;
+    }
+    std::string line = absl::StrFormat("%s%c,%u,%hu,%u", symbol, record.side == SELL_OS ? 'S' : 'B', record.id, record.price, record.quantity);
+    if (record.type == ICEBERG_ORDER) {
+        absl::StrAppendFormat(&line, ",%u", record.peak_size);
+    } else if (const char* type_name = ImmediateOrderTypeName(record.type)) {
+        absl::StrAppendFormat(&line, ",%s", type_name);
+    }
+    if (record.participant) {
+        absl::StrAppendFormat(&line, ",@%u", record.participant);
+    }
+    return line;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    google::InitGoogleLogging(argv[0]);
+
+    std::string path;
+    std::string record_path;
+    std::string verify_path;
+    uint64_t generate = 0;
+    uint64_t seed = 1;
+    bool valid_flags = true;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view argument(argv[i]);
+        if (argument.starts_with("--generate=")) {
+            valid_flags &= absl::SimpleAtoi(argument.substr(11), &generate) && generate > 0;
+        } else if (argument.starts_with("--seed=")) {
+            valid_flags &= absl::SimpleAtoi(argument.substr(7), &seed);
+        } else if (argument.starts_with("--record=")) {
+            record_path = argument.substr(9);
+        } else if (argument.starts_with("--verify=")) {
+            verify_path = argument.substr(9);
+        } else if (path.empty()) {
+            path = argument;
+        } else {
+            valid_flags = false;
+        }
+    }
+    if (!valid_flags || path.empty() == (generate == 0) || record_path.empty() == verify_path.empty()) {
+        std::cerr << "Usage: " << argv[0] << " <orders.csv|orders.journal|--generate=<count>> [--seed=<seed>]"
+                  << " --record=<golden>|--verify=<golden>\n";
+        return 2;
+    }
+
+    std::string error;
+    std::optional<DigestFile> golden;
+    if (!verify_path.empty()) {
+        golden = DigestFile::Read(verify_path, &error);
+        if (!golden) {
+            std::cerr << error << '\n';
+            return 1;
+        }
+    }
+
+    ReplayDigest replay;
+    DigestFile digests;
+    uint64_t events = 0;
+    std::optional<uint64_t> divergence;
+    // Returns false once the run diverged from the golden file.
+    auto apply = [&](const OrderRecord& record) {
+        uint64_t event = events++;
+        EventDigest digest = replay.Apply(record);
+        if (golden) {
+            if (event >= golden->events.size() || golden->events[event] != digest) {
+                divergence = event;
+                std::string what = "the golden run ended before it";
+                if (event < golden->events.size()) {
+                    what = golden->events[event].trades != digest.trades ? "its trades" : "the book state";
+                }
+                std::cerr << absl::StrFormat("Event %u (%s) diverges: %s\n", event, DescribeRecord(record), what);
+                return false;
+            }
+        } else {
+            digests.events.push_back(digest);
+        }
+        return true;
+    };
+
+    if (generate) {
+        OrderFlowConfig config;
+        config.seed = seed;
+        config.cancel_ratio = 0.1;
+        OrderFlowGenerator generator(config);
+        for (uint64_t i = 0; i < generate && apply(generator.Next()); ++i) {
+        }
+    } else {
+        std::optional<MappedFile> file = MappedFile::Open(path, &error);
+        std::optional<JournalReader> journal;
+        if (file && JournalReader::HasJournalHeader(file->data())) {
+            file.reset();
+            journal = JournalReader::Open(path, &error);
+        }
+        if (!file && !journal) {
+            std::cerr << error << '\n';
+            return 1;
+        }
+        if (journal) {
+            std::string journal_error;
+            for (const JournalRecord& record : journal->records(&journal_error)) {
+                if (record.is_order() && !apply(record.ToOrder())) {
+                    break;
+                }
+            }
+            if (!journal_error.empty()) {
+                std::cerr << journal_error << '\n';
+                return 1;
+            }
+        } else {
+            BatchOrderParser parser(file->data());
+            std::vector<OrderRecord> batch(kBatchSize);
+            bool diverged = false;
+            while (size_t count = parser.Next(batch)) {
+                for (size_t i = 0; i < count && !diverged; ++i) {
+                    diverged = !apply(batch[i]);
+                }
+                if (diverged) {
+                    break;
+                }
+            }
+            for (const ParseError& parse_error : parser.errors()) {
+                std::cerr << absl::StrFormat("%s:%u: %s\n", path, parse_error.line_number, parse_error.reason);
+            }
+        }
+    }
+
+    if (!golden) {
+        digests.book_contents = replay.BookContents();
+        if (!digests.Write(record_path, &error)) {
+            std::cerr << error << '\n';
+            return 1;
+        }
+        std::cerr << absl::StrFormat("Recorded %u events to %s\n", events, record_path);
+        return 0;
+    }
+    if (divergence) {
+        return 1;
+    }
+    if (events != golden->events.size()) {
+        std::cerr << absl::StrFormat("Input ended after %u events, the golden run had %u\n", events, golden->events.size());
+        return 1;
+    }
+    if (replay.BookContents() != golden->book_contents) {
+        std::cerr << "Final resting orders differ\n";
+        return 1;
+    }
+    std::cerr << absl::StrFormat("%u events match %s\n", events, verify_path);
+    return 0;
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "absl/strings/str_format.h"
+#include "homework.h"
+#include "mapped_file.h"
+
+
+// Rolling checksums of the engine's output. `trades` covers every execution
+// report so far and `book` every price level change and every record's
+// OrderResult, which also covers the hidden volume of icebergs, so two runs
+// agree on an event only if they agreed on everything before it.
+struct EventDigest {
+    uint64_t trades = 0;
+    uint64_t book = 0;
+
+    bool operator==(const EventDigest&) const = default;
+};
+
+// Replays input events through a MatchingSystem and records the digests after
+// each one. The mixing is fixed arithmetic rather than absl::Hash, which is
+// seeded per process, so digests can be compared across runs and builds.
+class ReplayDigest : private TradeSink, private MarketDataSubscriber {
+public:
+    ReplayDigest() : system_(OutputPolicy::TradesOnly(), this) {
+        system_.SetMarketDataSubscriber(this);
+    }
+
+    ReplayDigest(const ReplayDigest&) = delete;
+    ReplayDigest& operator=(const ReplayDigest&) = delete;
+
+    EventDigest Apply(const OrderRecord& record) {
+        OrderResult result;
+        system_.AddOrders(std::span(&record, 1), std::span(&result, 1));
+        digest_.book = Mix(digest_.book, uint64_t{static_cast<uint8_t>(result.status)} << 32 | result.resting_quantity);
+        return digest_;
+    }
+
+    // Checksum of every resting order, in time priority; catches differences
+    // within a level that the level aggregates hide.
+    uint64_t BookContents() const {
+        uint64_t hash = 0;
+        system_.order_book().ForEachOrder([&hash](const LimitOrder& order) {
+            hash = Mix(hash, order.id());
+            hash = Mix(hash, uint64_t{order.price()} << 40 | uint64_t{static_cast<uint8_t>(order.side())} << 32 | order.quantity());
+            hash = Mix(hash, uint64_t{order.hidden_full_volume()} << 32 | order.peak_size());
+        });
+        return hash;
+    }
+
+    const EventDigest& digest() const {
+        return digest_;
+    }
+
+    const MatchingSystem& system() const {
+        return system_;
+    }
+
+private:
+    static uint64_t Mix(uint64_t hash, uint64_t value) {
+        hash = (hash ^ value) * 0x9e3779b97f4a7c15;
+        return hash ^ (hash >> 29);
+    }
+
+    void OnTrade(const Trade& trade) override {
+        digest_.trades = Mix(digest_.trades, uint64_t{trade.symbol} << 32 | trade.buy_id);
+        digest_.trades = Mix(digest_.trades, uint64_t{trade.sell_id} << 32 | trade.quantity);
+        digest_.trades = Mix(digest_.trades, trade.price);
+    }
+
+    void OnLevelDelta(const LevelDelta& delta) override {
+        const BookLevel& level = delta.level;
+        digest_.book = Mix(digest_.book, uint64_t{static_cast<uint8_t>(delta.kind)} << 40 | uint64_t{static_cast<uint8_t>(level.side)} << 32 | level.price);
+        digest_.book = Mix(digest_.book, uint64_t{level.order_count} << 32 ^ level.volume);
+    }
+
+    EventDigest digest_;
+    MatchingSystem system_;
+};
+
+
+// Golden file of a replay: a DigestHeader followed by one EventDigest per input event.
+static_assert(std::endian::native == std::endian::little, "Digests are stored in host byte order");
+
+struct DigestHeader {
+    static constexpr char kMagic[8] = {'O', 'B', 'D', 'I', 'G', 'S', 'T', '\0'};
+    static constexpr uint32_t kVersion = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t event_count;
+    uint64_t book_contents;  // ReplayDigest::BookContents() after the last event.
+};
+
+static_assert(sizeof(DigestHeader) == 32 && std::is_trivially_copyable_v<DigestHeader>);
+static_assert(sizeof(EventDigest) == 16 && std::is_trivially_copyable_v<EventDigest>);
+
+struct DigestFile {
+    std::vector<EventDigest> events;
+    uint64_t book_contents = 0;
+
+    static std::optional<DigestFile> Read(const std::string& path, std::string* error) {
+        std::optional<MappedFile> file = MappedFile::Open(path, error);
+        if (!file) {
+            return std::nullopt;
+        }
+        std::string_view data = file->data();
+        DigestHeader header;
+        if (data.size() < sizeof(header) || std::memcmp(data.data(), DigestHeader::kMagic, sizeof(DigestHeader::kMagic)) != 0) {
+            *error = absl::StrFormat("%s is not a digest file", path);
+            return std::nullopt;
+        }
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (header.version != DigestHeader::kVersion || header.record_size != sizeof(EventDigest)) {
+            *error = absl::StrFormat("%s has unsupported digest version %u with %u-byte records", path, header.version, header.record_size);
+            return std::nullopt;
+        }
+        // Divides first, so a damaged count cannot overflow the size it implies.
+        size_t record_bytes = data.size() - sizeof(header);
+        if (record_bytes % sizeof(EventDigest) != 0 || record_bytes / sizeof(EventDigest) != header.event_count) {
+            *error = absl::StrFormat("%s should hold %u events but has %u bytes of them", path, header.event_count, data.size() - sizeof(header));
+            return std::nullopt;
+        }
+        DigestFile digests{.events = std::vector<EventDigest>(header.event_count), .book_contents = header.book_contents};
+        std::memcpy(digests.events.data(), data.data() + sizeof(header), header.event_count * sizeof(EventDigest));
+        return digests;
+    }
+
+    // Returns false and sets `error` if the file could not be written.
+    bool Write(const std::string& path, std::string* error) const {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            *error = absl::StrFormat("Cannot create %s", path);
+            return false;
+        }
+        DigestHeader header{
+            .version = DigestHeader::kVersion,
+            .record_size = sizeof(EventDigest),
+            .event_count = events.size(),
+            .book_contents = book_contents,
+        };
+        std::memcpy(header.magic, DigestHeader::kMagic, sizeof(header.magic));
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(events.data()), events.size() * sizeof(EventDigest));
+        out.flush();
+        if (!out) {
+            *error = absl::StrFormat("Cannot write %s", path);
+            return false;
+        }
+        return true;
+    }
+};
+
+// Index of the first event whose digests differ, or the length of the shorter
+// run if one is a prefix of the other; nullopt if the runs are identical.
+inline std::optional<uint64_t> FirstDivergence(std::span<const EventDigest> expected, std::span<const EventDigest> actual) {
+    size_t common = std::min(expected.size(), actual.size());
+    for (size_t i = 0; i < common; ++i) {
+        if (expected[i] != actual[i]) {
+            return i;
+        }
+    }
+    if (expected.size() != actual.size()) {
+        return common;
+    }
+    return std::nullopt;
+}
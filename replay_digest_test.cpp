@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include "order_flow_generator.h"
+#include "replay_digest.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+std::vector<EventDigest> Replay(std::span<const OrderRecord> flow, uint64_t* book_contents = nullptr) {
+    ReplayDigest replay;
+    std::vector<EventDigest> digests;
+    for (const OrderRecord& record : flow) {
+        digests.push_back(replay.Apply(record));
+    }
+    if (book_contents) {
+        *book_contents = replay.BookContents();
+    }
+    return digests;
+}
+
+}  // namespace
+
+TEST(ReplayDigestTest, ReportsFirstDivergentEvent) {
+    OrderFlowConfig config;
+    config.iceberg_ratio = 0.3;
+    config.cancel_ratio = 0.1;
+    std::vector<OrderRecord> flow = OrderFlowGenerator(config).Generate(20000);
+    std::vector<EventDigest> golden = Replay(flow);
+    EXPECT_EQ(FirstDivergence(golden, Replay(flow)), std::nullopt);
+
+    const size_t kChanged = 15000;
+    ASSERT_EQ(flow[kChanged].action, OrderAction::kAdd);
+    std::vector<OrderRecord> changed = flow;
+    changed[kChanged].quantity += 1;
+    EXPECT_EQ(FirstDivergence(golden, Replay(changed)), kChanged);
+
+    EXPECT_EQ(FirstDivergence(golden, std::span(golden).first(100)), 100);
+}
+
+TEST(ReplayDigestTest, GoldenFileRoundTrip) {
+    std::string path = ::testing::TempDir() + "/replay_digest_test.digest";
+    std::vector<OrderRecord> flow = OrderFlowGenerator(OrderFlowConfig{}).Generate(1000);
+    DigestFile digests;
+    digests.events = Replay(flow, &digests.book_contents);
+    EXPECT_NE(digests.book_contents, 0);
+    std::string error;
+    ASSERT_TRUE(digests.Write(path, &error)) << error;
+
+    std::optional<DigestFile> golden = DigestFile::Read(path, &error);
+    ASSERT_TRUE(golden) << error;
+    EXPECT_EQ(golden->events, digests.events);
+    EXPECT_EQ(golden->book_contents, digests.book_contents);
+    std::remove(path.c_str());
+}
+
+TEST(ReplayDigestTest, RejectsDamagedEventCount) {
+    std::string path = ::testing::TempDir() + "/replay_digest_test_damaged.digest";
+    DigestFile digests;
+    digests.events.resize(4);
+    std::string error;
+    ASSERT_TRUE(digests.Write(path, &error)) << error;
+    std::string contents;
+    {
+        std::ifstream in(path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    DigestHeader header;
+    std::memcpy(&header, contents.data(), sizeof(header));
+
+    // A wrong count, and one whose byte size wraps around to the 64 bytes held.
+    for (uint64_t event_count : {uint64_t{5}, (uint64_t{1} << 60) + 4}) {
+        header.event_count = event_count;
+        std::memcpy(contents.data(), &header, sizeof(header));
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(contents.data(), static_cast<std::streamsize>(contents.size()));
+        EXPECT_FALSE(DigestFile::Read(path, &error)) << event_count;
+        EXPECT_NE(error.find("should hold"), std::string::npos) << error;
+    }
+    std::remove(path.c_str());
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    ::testing::GTEST_FLAG(output) = "stdout";
+
+    return RUN_ALL_TESTS();
+}
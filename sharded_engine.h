@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+#include "absl/container/flat_hash_map.h"
+#include "homework.h"
+#include "spsc_queue.h"
+
+
+struct ShardStats {
+    uint64_t records = 0;
+    uint64_t rejected = 0;          // Records the books rejected, for any OrderResult::Status.
+    uint64_t books = 0;
+    uint64_t memory_bytes = 0;      // Heap memory of the books, see MatchingSystem::memory_stats().
+    uint64_t full_queue_spins = 0;  // Times Submit() found the shard's inbox full.
+};
+
+// Matches many instruments at once. Symbols are partitioned across one worker
+// thread per shard; each worker exclusively owns the books of its symbols, so
+// matching needs no locks. A single ingress thread calls Submit(), which routes
+// each record through the owning shard's SPSC inbox. Records of one symbol
+// always go to the same inbox, so they are applied in submission order.
+//
+// A shard creates a book for each new symbol it sees. Price ladders are
+// allocated in pages of 256 prices as the book first uses them: an empty
+// book's take 17KB and each page about 12.5KB more per side, up to 6.3MB for
+// every price. Resting orders add 176KB of order pool per 4096.
+// ShardStats::memory_bytes reports the total.
+class ShardedMatchingEngine {
+public:
+    // Each shard reports its trades to its own sink, which is only ever called
+    // from that shard's worker thread.
+    explicit ShardedMatchingEngine(const std::vector<TradeSink*>& shard_sinks, size_t queue_capacity = 1 << 16) {
+        if (shard_sinks.empty()) {
+            LOG(FATAL) << "At least one shard is required";
+        }
+        shards_.reserve(shard_sinks.size());
+        for (TradeSink* sink : shard_sinks) {
+            if (!sink) {
+                LOG(FATAL) << "Every shard needs a trade sink";
+            }
+            shards_.push_back(std::make_unique<Shard>(*sink, queue_capacity));
+        }
+        for (auto& shard : shards_) {
+            shard->worker = std::thread(&ShardedMatchingEngine::Run, shard.get());
+        }
+    }
+
+    ShardedMatchingEngine(const ShardedMatchingEngine&) = delete;
+    ShardedMatchingEngine& operator=(const ShardedMatchingEngine&) = delete;
+
+    ~ShardedMatchingEngine() {
+        Stop();
+    }
+
+    size_t shard_count() const {
+        return shards_.size();
+    }
+
+    size_t ShardOf(uint32_t symbol) const {
+        return symbol % shards_.size();
+    }
+
+    // Must only be called from the ingress thread. Spins while the shard's inbox is full.
+    void Submit(const OrderRecord& record) {
+        Shard& shard = *shards_[ShardOf(record.symbol)];
+        while (!shard.inbox.TryPush(record)) {
+            ++shard.full_queue_spins;
+            std::this_thread::yield();
+        }
+        ++shard.submitted;
+    }
+
+    // Waits until every submitted record is applied and its trades are flushed.
+    // Until the next Submit(), the books may then be inspected from the ingress thread.
+    void Drain() {
+        for (auto& shard : shards_) {
+            while (shard->published.load(std::memory_order_acquire) != shard->submitted) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Drains and joins the workers; no records may be submitted afterwards.
+    void Stop() {
+        if (stopped_) {
+            return;
+        }
+        Drain();
+        for (auto& shard : shards_) {
+            shard->stopping.store(true, std::memory_order_release);
+        }
+        for (auto& shard : shards_) {
+            shard->worker.join();
+        }
+        stopped_ = true;
+    }
+
+    // Only valid after Drain() or Stop().
+    const MatchingSystem* Find(uint32_t symbol) const {
+        const Shard& shard = *shards_[ShardOf(symbol)];
+        auto it = shard.books.find(symbol);
+        return it == shard.books.end() ? nullptr : it->second.get();
+    }
+
+    // Only valid after Drain() or Stop().
+    ShardStats stats(size_t shard_index) const {
+        const Shard& shard = *shards_[shard_index];
+        ShardStats stats{
+            .records = shard.submitted,
+            .rejected = shard.rejected,
+            .books = shard.books.size(),
+            .full_queue_spins = shard.full_queue_spins,
+        };
+        for (const auto& [symbol, book] : shard.books) {
+            stats.memory_bytes += book->memory_stats().total();
+        }
+        return stats;
+    }
+
+private:
+    struct Shard {
+        Shard(TradeSink& trade_sink, size_t queue_capacity) : sink(trade_sink), inbox(queue_capacity) {
+        }
+
+        TradeSink& sink;
+        SpscQueue<OrderRecord> inbox;
+        std::thread worker;
+        std::atomic<bool> stopping{false};
+        // Records applied with their trades flushed; written by the worker.
+        alignas(64) std::atomic<uint64_t> published{0};
+        // Owned by the worker.
+        absl::flat_hash_map<uint32_t, std::unique_ptr<MatchingSystem>> books;
+        uint64_t rejected = 0;
+        // Owned by the ingress thread.
+        alignas(64) uint64_t submitted = 0;
+        uint64_t full_queue_spins = 0;
+    };
+
+    static void Run(Shard* shard) {
+        OrderRecord record;
+        uint64_t applied = 0;
+        while (true) {
+            if (shard->inbox.TryPop(record)) {
+                std::unique_ptr<MatchingSystem>& book = shard->books[record.symbol];
+                if (!book) {
+                    book = std::make_unique<MatchingSystem>(OutputPolicy::TradesOnly(), &shard->sink);
+                }
+                shard->rejected += !book->Apply(record);
+                ++applied;
+                continue;
+            }
+            if (applied != shard->published.load(std::memory_order_relaxed)) {
+                shard->sink.Flush();
+                shard->published.store(applied, std::memory_order_release);
+                continue;
+            }
+            if (shard->stopping.load(std::memory_order_acquire)) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    bool stopped_ = false;
+};
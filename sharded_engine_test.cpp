@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include "sharded_engine.h"
+#include <vector>
+
+namespace {
+
+class RecordingTradeSink : public TradeSink {
+public:
+    void OnTrade(const Trade& trade) override {
+        trades.push_back(trade);
+    }
+
+    void Flush() override {
+        ++flushes;
+    }
+
+    std::vector<Trade> trades;
+    int flushes = 0;
+};
+
+}  // namespace
+
+TEST(ShardedMatchingEngineTest, RoutesSymbolsToOwningShard) {
+    RecordingTradeSink first, second;
+    ShardedMatchingEngine engine({&first, &second}, 4);
+    ASSERT_EQ(engine.shard_count(), 2);
+    for (uint32_t symbol : {2u, 3u}) {
+        engine.Submit({.symbol = symbol, .id = 0, .quantity = 10, .side = SELL_OS, .price = 100});
+        engine.Submit({.symbol = symbol, .id = 1, .quantity = 4, .side = BUY_OS, .price = 100});
+        engine.Submit({.symbol = symbol, .id = 1, .action = OrderAction::kCancel});
+    }
+    engine.Drain();
+
+    ASSERT_EQ(first.trades.size(), 1);
+    EXPECT_EQ(first.trades[0].ToString(), "2,1,0,100,4");
+    ASSERT_EQ(second.trades.size(), 1);
+    EXPECT_EQ(second.trades[0].ToString(), "3,1,0,100,4");
+    EXPECT_GT(first.flushes, 0);
+
+    const MatchingSystem* book = engine.Find(3);
+    ASSERT_NE(book, nullptr);
+    ASSERT_NE(book->order_book().Find(0), nullptr);
+    EXPECT_EQ(book->order_book().Find(0)->quantity(), 6);
+    EXPECT_EQ(engine.Find(4), nullptr);
+
+    ShardStats stats = engine.stats(0);
+    EXPECT_EQ(stats.records, 3);
+    EXPECT_EQ(stats.rejected, 1);
+    EXPECT_EQ(stats.books, 1);
+}
+
+TEST(ShardedMatchingEngineTest, ThinBooksStaySmall) {
+    RecordingTradeSink sink;
+    ShardedMatchingEngine engine({&sink}, 64);
+    constexpr uint32_t kSymbols = 1000;
+    for (uint32_t symbol = 0; symbol < kSymbols; ++symbol) {
+        engine.Submit({.symbol = symbol, .id = 0, .quantity = 10, .side = SELL_OS, .price = static_cast<uint16_t>(100 + symbol * 60)});
+    }
+    engine.Drain();
+
+    ShardStats stats = engine.stats(0);
+    EXPECT_EQ(stats.books, kSymbols);
+    EXPECT_EQ(stats.rejected, 0);
+    uint64_t memory_bytes = 0;
+    for (uint32_t symbol = 0; symbol < kSymbols; ++symbol) {
+        MemoryStats memory = engine.Find(symbol)->memory_stats();
+        EXPECT_LT(memory.price_ladders, 64 * 1024);
+        memory_bytes += memory.total();
+    }
+    EXPECT_EQ(stats.memory_bytes, memory_bytes);
+}
+
+TEST(ShardedMatchingEngineTest, MatchesLikeSingleBooks) {
+    constexpr uint32_t kSymbols = 16;
+    constexpr uint32_t kOrdersPerSymbol = 2000;
+    std::vector<OrderRecord> flow;
+    for (uint32_t id = 0; id < kOrdersPerSymbol; ++id) {
+        for (uint32_t symbol = 0; symbol < kSymbols; ++symbol) {
+            bool buy = (id * 7 + symbol) % 3 == 0;
+            flow.push_back({.symbol = symbol, .id = id, .quantity = 1 + (id * 13 + symbol) % 50,
+                            .side = buy ? BUY_OS : SELL_OS, .price = static_cast<uint16_t>(buy ? 100 + id % 5 : 102 + id % 5)});
+        }
+    }
+
+    std::vector<RecordingTradeSink> sinks(4);
+    {
+        ShardedMatchingEngine engine({&sinks[0], &sinks[1], &sinks[2], &sinks[3]}, 64);
+        for (const OrderRecord& record : flow) {
+            engine.Submit(record);
+        }
+        engine.Stop();
+    }
+
+    for (uint32_t symbol = 0; symbol < kSymbols; ++symbol) {
+        RecordingTradeSink expected;
+        {
+            MatchingSystem system(OutputPolicy::TradesOnly(), &expected);
+            for (const OrderRecord& record : flow) {
+                if (record.symbol == symbol) {
+                    system.Apply(record);
+                }
+            }
+        }
+        std::vector<std::string> actual_trades;
+        for (const Trade& trade : sinks[symbol % 4].trades) {
+            if (trade.symbol == symbol) {
+                actual_trades.push_back(trade.ToString());
+            }
+        }
+        std::vector<std::string> expected_trades;
+        for (const Trade& trade : expected.trades) {
+            expected_trades.push_back(trade.ToString());
+        }
+        EXPECT_FALSE(expected_trades.empty());
+        EXPECT_EQ(actual_trades, expected_trades) << "symbol " << symbol;
+    }
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    ::testing::GTEST_FLAG(output) = "stdout";
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include "book_snapshot.h"
+#include "homework.h"
+
+
+// Renders views of an OrderBook on its own thread, so the matching thread only
+// pays for copying the captured levels. Delivery is latest-wins: a view still
+// waiting when the next one is published is dropped, so a slow consumer never
+// holds matching back and is at most one view behind. Three snapshots rotate
+// between the publisher, the mailbox and the render thread, so publishing does
+// not allocate once they have grown to the book's size.
+class SnapshotRenderer {
+public:
+    // Writes every rendered view to `out`, which must outlive the renderer.
+    SnapshotRenderer(std::ostream& out, SnapshotFormat format, size_t max_levels = PriceLevelBitmap::kLevels)
+        : out_(out), format_(format), max_levels_(max_levels), thread_([this] { Run(); }) {
+    }
+
+    SnapshotRenderer(const SnapshotRenderer&) = delete;
+    SnapshotRenderer& operator=(const SnapshotRenderer&) = delete;
+
+    // Renders the last published view, if it is still waiting, and stops.
+    ~SnapshotRenderer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        ready_.notify_one();
+        thread_.join();
+    }
+
+    // Captures the book and hands it to the render thread. Only orders the
+    // table shows are copied; depth formats take the levels alone.
+    void Publish(const OrderBook& book, uint64_t sequence) {
+        book.CaptureSnapshot(*capturing_, max_levels_, format_ == SnapshotFormat::kTable);
+        capturing_->sequence = sequence;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::swap(capturing_, pending_);
+            dropped_ += has_pending_;
+            has_pending_ = true;
+        }
+        ready_.notify_one();
+        ++published_;
+    }
+
+    // Views passed to Publish(); only call from the publishing thread.
+    uint64_t published() const {
+        return published_;
+    }
+
+    // Views replaced by a newer one before the render thread got to them.
+    uint64_t dropped() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dropped_;
+    }
+
+private:
+    void Run() {
+        std::string text;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this] { return has_pending_ || stopping_; });
+                if (!has_pending_) {
+                    return;
+                }
+                std::swap(rendering_, pending_);
+                has_pending_ = false;
+            }
+            text.clear();
+            RenderSnapshot(*rendering_, format_, text);
+            out_.write(text.data(), static_cast<std::streamsize>(text.size()));
+            out_.flush();
+        }
+    }
+
+    std::ostream& out_;
+    const SnapshotFormat format_;
+    const size_t max_levels_;
+    std::unique_ptr<BookSnapshot> capturing_ = std::make_unique<BookSnapshot>();  // Publisher's.
+    std::unique_ptr<BookSnapshot> rendering_ = std::make_unique<BookSnapshot>();  // Render thread's.
+    uint64_t published_ = 0;
+
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::unique_ptr<BookSnapshot> pending_ = std::make_unique<BookSnapshot>();
+    bool has_pending_ = false;
+    bool stopping_ = false;
+    uint64_t dropped_ = 0;
+
+    std::thread thread_;  // Last, so it starts after everything it uses.
+};
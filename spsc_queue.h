@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Each side keeps a cached copy of the other side's index so the shared cache
+// lines are only touched when the queue looks full (or empty).
+template <typename T>
+class SpscQueue {
+    static_assert(std::is_trivially_copyable_v<T>, "SpscQueue elements are copied by value");
+public:
+    explicit SpscQueue(size_t capacity)
+        : capacity_(std::bit_ceil(std::max<size_t>(capacity, 2))), mask_(capacity_ - 1), slots_(std::make_unique<T[]>(capacity_)) {
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    bool TryPush(const T& value) {
+        size_t tail = producer_.index.load(std::memory_order_relaxed);
+        if (tail - producer_.cached_other == capacity_) {
+            producer_.cached_other = consumer_.index.load(std::memory_order_acquire);
+            if (tail - producer_.cached_other == capacity_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = value;
+        producer_.index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& value) {
+        size_t head = consumer_.index.load(std::memory_order_relaxed);
+        if (head == consumer_.cached_other) {
+            consumer_.cached_other = producer_.index.load(std::memory_order_acquire);
+            if (head == consumer_.cached_other) {
+                return false;
+            }
+        }
+        value = slots_[head & mask_];
+        consumer_.index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate when called concurrently with either side, also from a third
+    // thread. The consumer index is read first: the consumer never passes the
+    // producer, so the producer index read after it is at least as large.
+    size_t size() const {
+        size_t consumed = consumer_.index.load(std::memory_order_acquire);
+        size_t produced = producer_.index.load(std::memory_order_acquire);
+        return std::min(produced - consumed, capacity_);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+private:
+    static constexpr size_t kCacheLine = 64;
+
+    struct alignas(kCacheLine) Cursor {
+        std::atomic<size_t> index{0};
+        size_t cached_other = 0;
+    };
+
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<T[]> slots_;
+    Cursor producer_;
+    Cursor consumer_;
+};
+
+
+// How a thread waits for the queue on the other side to make progress.
+enum class WaitPolicy {
+    kBusySpin,  // Polls continuously; lowest latency, but keeps the core busy.
+    kAdaptive,  // Polls for a while, then yields the core between polls.
+};
+
+class Backoff {
+public:
+    explicit Backoff(WaitPolicy policy) : policy_(policy) {
+    }
+
+    void Wait() {
+        if (policy_ == WaitPolicy::kAdaptive && spins_ >= kSpinsBeforeYield) {
+            std::this_thread::yield();
+            return;
+        }
+        ++spins_;
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+    }
+
+    // Called once the awaited progress happened.
+    void Reset() {
+        spins_ = 0;
+    }
+
+private:
+    static constexpr uint32_t kSpinsBeforeYield = 1024;
+
+    WaitPolicy policy_;
+    uint32_t spins_ = 0;
+};
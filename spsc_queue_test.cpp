@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include "spsc_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+TEST(SpscQueueTest, WrapsAround) {
+    SpscQueue<int> queue(3);
+    EXPECT_EQ(queue.capacity(), 4);
+    int value = 0;
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < 4; ++i) {
+            EXPECT_TRUE(queue.TryPush(round * 4 + i));
+        }
+        EXPECT_FALSE(queue.TryPush(-1));
+        EXPECT_EQ(queue.size(), 4);
+        for (int i = 0; i < 4; ++i) {
+            EXPECT_TRUE(queue.TryPop(value));
+            EXPECT_EQ(value, round * 4 + i);
+        }
+        EXPECT_FALSE(queue.TryPop(value));
+        EXPECT_TRUE(queue.empty());
+    }
+}
+
+TEST(SpscQueueTest, TransfersAcrossThreads) {
+    constexpr uint64_t kCount = 1000000;
+    SpscQueue<uint64_t> queue(1024);
+    std::thread producer([&queue] {
+        for (uint64_t i = 0; i < kCount; ++i) {
+            while (!queue.TryPush(i)) {
+            }
+        }
+    });
+    uint64_t expected = 0;
+    uint64_t value;
+    while (expected < kCount) {
+        if (queue.TryPop(value)) {
+            ASSERT_EQ(value, expected);
+            ++expected;
+        }
+    }
+    producer.join();
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(SpscQueueTest, SizeSeenFromThirdThreadStaysInRange) {
+    constexpr uint64_t kCount = 200000;
+    SpscQueue<uint64_t> queue(64);
+    std::atomic<bool> done{false};
+    size_t largest = 0;
+    std::thread poller([&] {
+        while (!done.load(std::memory_order_relaxed)) {
+            largest = std::max(largest, queue.size());
+        }
+    });
+    std::thread producer([&queue] {
+        for (uint64_t i = 0; i < kCount; ++i) {
+            while (!queue.TryPush(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    uint64_t value;
+    for (uint64_t popped = 0; popped < kCount;) {
+        if (queue.TryPop(value)) {
+            ++popped;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    done = true;
+    poller.join();
+    EXPECT_LE(largest, queue.capacity());
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    ::testing::GTEST_FLAG(output) = "stdout";
+
+    return RUN_ALL_TESTS();
+}